@@ -0,0 +1,420 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "approx_recovery.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#define APPROX_MAX_CORRUPT_ELEMS (MAX_WORD_SIZE+2)
+
+approx_stats_t g_approx_stats;
+
+//Static because we don't want these allocated on the stack in trap context. The kernels below are written as flat loops over these arrays so the compiler can vectorize them.
+static unsigned char line_bytes[APPROX_MAX_LINE_BYTES];
+static double known_vals[APPROX_MAX_LINE_BYTES];
+static long known_idx[APPROX_MAX_LINE_BYTES];
+static double scratch[APPROX_MAX_LINE_BYTES];
+static unsigned long corrupt_addr[APPROX_MAX_CORRUPT_ELEMS];
+static long corrupt_idx[APPROX_MAX_CORRUPT_ELEMS];
+static double corrupt_pred[APPROX_MAX_CORRUPT_ELEMS];
+
+static const size_t approx_elem_sizes[APPROX_TYPE_NUM] = {
+    sizeof(float),
+    sizeof(double),
+    sizeof(char),
+    sizeof(unsigned char),
+    sizeof(short),
+    sizeof(unsigned short),
+    sizeof(int),
+    sizeof(unsigned),
+    sizeof(long),
+    sizeof(unsigned long)
+};
+
+size_t approx_elem_size(approx_elem_type_t type) {
+    if (type < 0 || type >= APPROX_TYPE_NUM)
+        return 0;
+    return approx_elem_sizes[type];
+}
+
+//Uses memcpy() to get around the strict aliasing issues noted in dump_load_value()
+double approx_decode_element(const unsigned char* bytes, approx_elem_type_t type) {
+    switch (type) {
+        case APPROX_TYPE_FLOAT: { float v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_DOUBLE: { double v; memcpy(&v, bytes, sizeof(v)); return v; }
+        case APPROX_TYPE_CHAR: { char v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_UNSIGNED_CHAR: { unsigned char v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_SHORT: { short v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_UNSIGNED_SHORT: { unsigned short v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_INT: { int v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_UNSIGNED: { unsigned v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_LONG: { long v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        case APPROX_TYPE_UNSIGNED_LONG: { unsigned long v; memcpy(&v, bytes, sizeof(v)); return (double)v; }
+        default: return 0;
+    }
+}
+
+int approx_is_finite(double v) {
+    return (v == v && v - v == 0) ? 1 : 0; //NaN fails the first test, +/-Inf fails the second
+}
+
+//Reassembles the DUE cacheline as flat bytes in line (at least APPROX_MAX_LINE_BYTES), with the OS-recovered message standing in for
+//the victim. Returns the address of the start of the line and sets msg_addr to the victim's, or returns 0 if the cacheline is malformed.
+unsigned long approx_assemble_line(const dueinfo_t* dueinfo, unsigned char* line, unsigned long* msg_addr) {
+    size_t msg_size = dueinfo->recovered_message.size;
+    const due_cacheline_t* cl = &(dueinfo->cacheline);
+    if (msg_size == 0 || msg_size > MAX_WORD_SIZE || cl->size > MAX_CACHELINE_WORDS || cl->blockpos >= cl->size)
+        return 0;
+    unsigned long addr = (unsigned long)(dueinfo->tf.badvaddr) - (unsigned long)(dueinfo->tf.badvaddr) % msg_size;
+    for (size_t i = 0; i < cl->size; i++)
+        memcpy(line + i*msg_size, (i == cl->blockpos ? dueinfo->recovered_message.bytes : cl->words[i].bytes), msg_size);
+    if (msg_addr)
+        *msg_addr = addr;
+    return addr - cl->blockpos * msg_size;
+}
+
+static double approx_round(double v) {
+    if (v >= 4503599627370496.0 || v <= -4503599627370496.0) //2^52, already integral
+        return v;
+    return (double)(long)(v + (v < 0 ? -0.5 : 0.5));
+}
+
+static double approx_clamp(double v, double lo, double hi) {
+    return (v < lo ? lo : (v > hi ? hi : v));
+}
+
+void approx_encode_element(unsigned char* bytes, double value, approx_elem_type_t type) {
+    double r = approx_round(value);
+    switch (type) {
+        case APPROX_TYPE_FLOAT: { float v = (float)value; memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_DOUBLE: { double v = value; memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_CHAR: { char v = (char)approx_clamp(r, CHAR_MIN, CHAR_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_UNSIGNED_CHAR: { unsigned char v = (unsigned char)approx_clamp(r, 0, UCHAR_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_SHORT: { short v = (short)approx_clamp(r, SHRT_MIN, SHRT_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_UNSIGNED_SHORT: { unsigned short v = (unsigned short)approx_clamp(r, 0, USHRT_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_INT: { int v = (int)approx_clamp(r, INT_MIN, INT_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_UNSIGNED: { unsigned v = (unsigned)approx_clamp(r, 0, UINT_MAX); memcpy(bytes, &v, sizeof(v)); break; }
+        case APPROX_TYPE_LONG: {
+            long v;
+            if (r >= (double)LONG_MAX) //(double)LONG_MAX rounds up to 2^63, which does not fit
+                v = LONG_MAX;
+            else if (r <= (double)LONG_MIN)
+                v = LONG_MIN;
+            else
+                v = (long)r;
+            memcpy(bytes, &v, sizeof(v));
+            break;
+        }
+        case APPROX_TYPE_UNSIGNED_LONG: {
+            unsigned long v;
+            if (r >= (double)ULONG_MAX) //(double)ULONG_MAX rounds up to 2^64, which does not fit
+                v = ULONG_MAX;
+            else if (r <= 0)
+                v = 0;
+            else
+                v = (unsigned long)r;
+            memcpy(bytes, &v, sizeof(v));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static double approx_mean(const double* vals, size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += vals[i];
+    return sum / (double)n;
+}
+
+//Hoare's selection on scratch[0..n), leaves the k-th smallest element at scratch[k] with everything before it no larger
+static double approx_select(double* a, size_t n, size_t k) {
+    size_t lo = 0;
+    size_t hi = n-1;
+    while (lo < hi) {
+        double pivot = a[(lo+hi)/2];
+        size_t i = lo;
+        size_t j = hi;
+        while (i <= j) {
+            while (a[i] < pivot)
+                i++;
+            while (a[j] > pivot)
+                j--;
+            if (i <= j) {
+                double tmp = a[i];
+                a[i] = a[j];
+                a[j] = tmp;
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return a[k];
+}
+
+static double approx_median(const double* vals, size_t n) {
+    memcpy(scratch, vals, n*sizeof(double));
+    double upper = approx_select(scratch, n, n/2);
+    if (n % 2 == 1)
+        return upper;
+    double lower = scratch[0];
+    for (size_t i = 1; i < n/2; i++)
+        lower = (scratch[i] > lower ? scratch[i] : lower);
+    return (lower + upper) / 2;
+}
+
+static double approx_interp(const double* vals, const long* idx, size_t n, long k) {
+    size_t right = 0;
+    while (right < n && idx[right] < k)
+        right++;
+    if (right == 0) //No left neighbor, hold the nearest right one
+        return vals[0];
+    if (right == n) //No right neighbor, hold the nearest left one
+        return vals[n-1];
+    size_t left = right-1;
+    double t = (double)(k - idx[left]) / (double)(idx[right] - idx[left]);
+    return vals[left] + t * (vals[right] - vals[left]);
+}
+
+static double approx_distance(const unsigned char* line, const unsigned long* addrs, const double* preds, size_t n, unsigned long line_base, approx_elem_type_t type) {
+    double dist = 0;
+    for (size_t i = 0; i < n; i++) {
+        double v = approx_decode_element(line + (addrs[i] - line_base), type);
+        if (!approx_is_finite(v))
+            return -1;
+        dist += (v > preds[i] ? v - preds[i] : preds[i] - v);
+    }
+    return dist;
+}
+
+int approx_recover(dueinfo_t* dueinfo, void* var_start, void* var_end, const approx_config_t* config) {
+    if (!dueinfo || !dueinfo->valid || !var_start || !var_end || !config)
+        return -4;
+    if (config->type < 0 || config->type >= APPROX_TYPE_NUM || config->policy < 0 || config->policy >= APPROX_POLICY_NUM)
+        return -4;
+
+    unsigned long starttick = get_sim_tick_counter();
+    g_approx_stats.invocations++;
+
+    size_t esize = approx_elem_sizes[config->type];
+    size_t stride = (config->stride == 0 ? esize : config->stride);
+    size_t msg_size = dueinfo->recovered_message.size;
+    due_cacheline_t* cl = &(dueinfo->cacheline);
+    unsigned long msg_addr = 0;
+    unsigned long line_base = (stride < esize ? 0 : approx_assemble_line(dueinfo, line_bytes, &msg_addr));
+    if (line_base == 0) {
+        g_approx_stats.failed++;
+        return -4;
+    }
+    unsigned long line_end = line_base + cl->size * msg_size;
+
+    //Classify each element of the variable that lies in this cacheline as known or corrupted
+    unsigned long base = (unsigned long)var_start + config->offset;
+    unsigned long end = (unsigned long)var_end;
+    unsigned long limit = (line_end < end ? line_end : end);
+    size_t num_known = 0;
+    size_t num_corrupt = 0;
+    long k = (line_base > base ? (long)((line_base - base + stride - 1) / stride) : 0);
+    for (unsigned long a = base + k*stride; a + esize <= limit; a += stride, k++) {
+        if (a < msg_addr + msg_size && a + esize > msg_addr) {
+            if (num_corrupt == APPROX_MAX_CORRUPT_ELEMS)
+                break;
+            corrupt_addr[num_corrupt] = a;
+            corrupt_idx[num_corrupt] = k;
+            num_corrupt++;
+        } else {
+            double v = approx_decode_element(line_bytes + (a - line_base), config->type);
+            if (approx_is_finite(v)) {
+                known_vals[num_known] = v;
+                known_idx[num_known] = k;
+                num_known++;
+            }
+        }
+    }
+
+    if (num_corrupt == 0 || num_known == 0) { //Victim message does not hold elements of this variable, or nothing to predict from
+        g_approx_stats.failed++;
+        return -4;
+    }
+
+    //Predict each corrupted element
+    double shared = 0;
+    if (config->policy == APPROX_POLICY_NEIGHBOR_MEAN)
+        shared = approx_mean(known_vals, num_known);
+    else if (config->policy == APPROX_POLICY_NEIGHBOR_MEDIAN)
+        shared = approx_median(known_vals, num_known);
+    for (size_t i = 0; i < num_corrupt; i++) {
+        if (config->policy == APPROX_POLICY_NEIGHBOR_MEAN || config->policy == APPROX_POLICY_NEIGHBOR_MEDIAN)
+            corrupt_pred[i] = shared;
+        else
+            corrupt_pred[i] = approx_interp(known_vals, known_idx, num_known, corrupt_idx[i]);
+    }
+
+    unsigned char* victim = line_bytes + cl->blockpos * msg_size;
+    int chose_candidate = 0;
+    if (config->policy == APPROX_POLICY_CLOSEST_CANDIDATE) {
+        double best_dist = -1;
+        size_t best = 0;
+        for (size_t c = 0; c < dueinfo->candidates.size; c++) {
+            if (dueinfo->candidates.candidate_messages[c].size != msg_size)
+                continue;
+            memcpy(victim, dueinfo->candidates.candidate_messages[c].bytes, msg_size);
+            double dist = approx_distance(line_bytes, corrupt_addr, corrupt_pred, num_corrupt, line_base, config->type);
+            if (dist >= 0 && (best_dist < 0 || dist < best_dist)) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+        if (best_dist >= 0) {
+            copy_word(&(dueinfo->recovered_message), dueinfo->candidates.candidate_messages+best);
+            chose_candidate = 1;
+        } else //No usable candidates, write the prediction itself
+            memcpy(victim, dueinfo->recovered_message.bytes, msg_size);
+    }
+
+    if (!chose_candidate) {
+        //Encode predictions in place; only the bytes falling inside the victim message are kept
+        for (size_t i = 0; i < num_corrupt; i++)
+            approx_encode_element(line_bytes + (corrupt_addr[i] - line_base), corrupt_pred[i], config->type);
+        memcpy(dueinfo->recovered_message.bytes, victim, msg_size);
+    }
+
+    g_approx_stats.recovered++;
+    g_approx_stats.policy_recovered[config->policy]++;
+    g_approx_stats.total_ticks += get_sim_tick_counter() - starttick;
+    return 0;
+}
+
+static unsigned long approx_rand(unsigned long* state) {
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void approx_flip_bits(unsigned char* bytes, size_t size, size_t nbits, unsigned long* state) {
+    for (size_t b = 0; b < nbits; b++) {
+        size_t bit = approx_rand(state) % (size*8);
+        bytes[bit/8] ^= (unsigned char)(1 << (bit%8));
+    }
+}
+
+//Injects synthetic DUEs into messages of a known array and runs every policy on each one, measuring prediction error against the
+//true contents. The OS guess is the true message with two bits flipped, and the candidate list holds the true message among decoys
+//that differ from the guess by two more bits, which is what a double-error-detecting code leaves behind. The array is only read.
+int approx_recovery_benchmark(void* var_start, void* var_end, approx_elem_type_t type, size_t msg_size, size_t trials, unsigned long seed, approx_benchmark_t* result) {
+    size_t esize = approx_elem_size(type);
+    if (!var_start || !var_end || !result || esize == 0 || msg_size == 0 || msg_size > MAX_WORD_SIZE || msg_size % esize != 0)
+        return -4;
+    size_t line_words = DUE_CACHELINE_SIZE / msg_size;
+    unsigned long first_msg = ((unsigned long)var_start + msg_size-1) / msg_size * msg_size;
+    unsigned long last_msg = (unsigned long)var_end / msg_size * msg_size;
+    if (last_msg <= first_msg || line_words == 0 || line_words > MAX_CACHELINE_WORDS || msg_size*line_words != DUE_CACHELINE_SIZE)
+        return -4;
+    size_t num_msgs = (size_t)(last_msg - first_msg) / msg_size;
+
+    static dueinfo_t injected; //Static because these are large data structures
+    static dueinfo_t info;
+    static word_t original;
+    unsigned long state = (seed ? seed : 0x9e3779b97f4a7c15UL);
+    memset(result, 0, sizeof(*result));
+
+    for (size_t t = 0; t < trials; t++) {
+        unsigned long msg_addr = first_msg + (approx_rand(&state) % num_msgs) * msg_size;
+        original.size = msg_size;
+        memcpy(original.bytes, (void*)msg_addr, msg_size);
+
+        memset(&injected, 0, sizeof(injected));
+        injected.valid = 1;
+        injected.tf.badvaddr = (long)msg_addr;
+        injected.recovered_message = original;
+        approx_flip_bits(injected.recovered_message.bytes, msg_size, 2, &state);
+        unsigned long line_base = msg_addr & ~((unsigned long)DUE_CACHELINE_SIZE-1);
+        injected.cacheline.size = line_words;
+        injected.cacheline.blockpos = (msg_addr - line_base) / msg_size;
+        for (size_t i = 0; i < line_words; i++) {
+            injected.cacheline.words[i].size = msg_size;
+            memcpy(injected.cacheline.words[i].bytes, (i == injected.cacheline.blockpos ? injected.recovered_message.bytes : (unsigned char*)(line_base + i*msg_size)), msg_size);
+        }
+        size_t num_candidates = 2 + approx_rand(&state) % (MAX_CANDIDATE_MSG/4);
+        size_t truth = approx_rand(&state) % num_candidates;
+        injected.candidates.size = num_candidates;
+        for (size_t c = 0; c < num_candidates; c++) {
+            injected.candidates.candidate_messages[c] = (c == truth ? original : injected.recovered_message);
+            if (c != truth)
+                approx_flip_bits(injected.candidates.candidate_messages[c].bytes, msg_size, 2, &state);
+        }
+
+        result->trials++;
+        for (size_t p = 0; p < APPROX_POLICY_NUM; p++) {
+            approx_config_t config = { type, (approx_policy_t)p, 0, 0 };
+            info = injected;
+            unsigned long ticks = g_approx_stats.total_ticks;
+            if (approx_recover(&info, var_start, var_end, &config) != 0) {
+                result->failed[p]++;
+                continue;
+            }
+            result->recovered[p]++;
+            result->ticks[p] += g_approx_stats.total_ticks - ticks;
+            if (memcmp(info.recovered_message.bytes, original.bytes, msg_size) == 0)
+                result->exact[p]++;
+            for (unsigned long a = msg_addr; a + esize <= msg_addr + msg_size; a += esize) {
+                if (a < (unsigned long)var_start || a + esize > (unsigned long)var_end || (a - (unsigned long)var_start) % esize != 0)
+                    continue;
+                double truth_val = approx_decode_element(original.bytes + (a - msg_addr), type);
+                double pred = approx_decode_element(info.recovered_message.bytes + (a - msg_addr), type);
+                if (!approx_is_finite(pred) || !approx_is_finite(truth_val)) {
+                    result->nonfinite[p] += (approx_is_finite(pred) ? 0 : 1);
+                    continue;
+                }
+                result->elems[p]++;
+                double err = (pred > truth_val ? pred - truth_val : truth_val - pred);
+                double mag = (truth_val < 0 ? -truth_val : truth_val);
+                double rel = err / (mag > APPROX_BENCHMARK_REL_FLOOR ? mag : APPROX_BENCHMARK_REL_FLOOR);
+                result->abs_err_sum[p] += err;
+                result->rel_err_sum[p] += rel;
+                if (rel > result->max_rel_err[p])
+                    result->max_rel_err[p] = rel;
+            }
+        }
+    }
+    return 0;
+}
+
+void dump_approx_stats() {
+    printf("Approximate recovery invocations: %lu\n", g_approx_stats.invocations);
+    printf("Approximate recovery successes: %lu\n", g_approx_stats.recovered);
+    printf("Approximate recovery failures: %lu\n", g_approx_stats.failed);
+    printf("Recovered by neighbor mean: %lu\n", g_approx_stats.policy_recovered[APPROX_POLICY_NEIGHBOR_MEAN]);
+    printf("Recovered by neighbor median: %lu\n", g_approx_stats.policy_recovered[APPROX_POLICY_NEIGHBOR_MEDIAN]);
+    printf("Recovered by linear interpolation: %lu\n", g_approx_stats.policy_recovered[APPROX_POLICY_LINEAR_INTERP]);
+    printf("Recovered by closest candidate: %lu\n", g_approx_stats.policy_recovered[APPROX_POLICY_CLOSEST_CANDIDATE]);
+    printf("Average recovery latency (ticks): %f\n", (g_approx_stats.recovered > 0 ? (double)(g_approx_stats.total_ticks) / (double)(g_approx_stats.recovered) : 0));
+}
+
+void dump_approx_benchmark(const approx_benchmark_t* result) {
+    static const char* names[APPROX_POLICY_NUM] = { "neighbor mean", "neighbor median", "linear interpolation", "closest candidate" };
+    printf("Approximate recovery benchmark: %lu trials\n", result->trials);
+    for (size_t p = 0; p < APPROX_POLICY_NUM; p++) {
+        unsigned long n = result->elems[p];
+        printf("%s: %lu recovered, %lu failed, %lu exact, %lu elements scored, mean abs error %f, mean rel error %f, max rel error %f, %lu non-finite, %f ticks per recovery\n", names[p], result->recovered[p], result->failed[p], result->exact[p], n,
+            (n > 0 ? result->abs_err_sum[p] / (double)n : 0.0), (n > 0 ? result->rel_err_sum[p] / (double)n : 0.0), result->max_rel_err[p], result->nonfinite[p],
+            (result->recovered[p] > 0 ? (double)(result->ticks[p]) / (double)(result->recovered[p]) : 0.0));
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Built-in numeric value-prediction recovery for approximable arrays of float, double and integer types.
+ * The corrupted element(s) of the victim message are predicted from the uncorrupted neighbors in the cacheline.
+ */
+
+#ifndef APPROX_RECOVERY_H
+#define APPROX_RECOVERY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define APPROX_MAX_LINE_BYTES (MAX_CACHELINE_WORDS*MAX_WORD_SIZE)
+#define APPROX_BENCHMARK_REL_FLOOR 1e-3 //Smallest true magnitude used as a relative error denominator by approx_recovery_benchmark()
+
+typedef enum {
+    APPROX_TYPE_FLOAT,
+    APPROX_TYPE_DOUBLE,
+    APPROX_TYPE_CHAR,
+    APPROX_TYPE_UNSIGNED_CHAR,
+    APPROX_TYPE_SHORT,
+    APPROX_TYPE_UNSIGNED_SHORT,
+    APPROX_TYPE_INT,
+    APPROX_TYPE_UNSIGNED,
+    APPROX_TYPE_LONG,
+    APPROX_TYPE_UNSIGNED_LONG,
+    APPROX_TYPE_NUM
+} approx_elem_type_t;
+
+typedef enum {
+    APPROX_POLICY_NEIGHBOR_MEAN, //Mean of all uncorrupted elements of the variable in the cacheline
+    APPROX_POLICY_NEIGHBOR_MEDIAN, //Median of all uncorrupted elements of the variable in the cacheline
+    APPROX_POLICY_LINEAR_INTERP, //Interpolate between the nearest uncorrupted elements on either side
+    APPROX_POLICY_CLOSEST_CANDIDATE, //Pick the candidate message closest to the interpolated prediction
+    APPROX_POLICY_NUM
+} approx_policy_t;
+
+typedef struct {
+    approx_elem_type_t type;
+    approx_policy_t policy;
+    size_t stride; //Bytes between consecutive elements, 0 means tightly packed
+    size_t offset; //Byte offset of the first element from the start of the variable
+} approx_config_t;
+
+typedef struct {
+    unsigned long invocations;
+    unsigned long recovered;
+    unsigned long failed;
+    unsigned long policy_recovered[APPROX_POLICY_NUM];
+    unsigned long total_ticks;
+} approx_stats_t;
+
+typedef struct {
+    unsigned long trials;
+    unsigned long recovered[APPROX_POLICY_NUM];
+    unsigned long failed[APPROX_POLICY_NUM];
+    unsigned long exact[APPROX_POLICY_NUM]; //Victim messages restored bit for bit
+    unsigned long elems[APPROX_POLICY_NUM]; //Corrupted elements scored, those with a finite true and predicted value
+    double abs_err_sum[APPROX_POLICY_NUM];
+    double rel_err_sum[APPROX_POLICY_NUM];
+    double max_rel_err[APPROX_POLICY_NUM];
+    unsigned long nonfinite[APPROX_POLICY_NUM]; //Predicted elements that were NaN or Inf
+    unsigned long ticks[APPROX_POLICY_NUM]; //Taken from g_approx_stats.total_ticks, successful recoveries only
+} approx_benchmark_t;
+
+#define VARIABLE_SCOPE_APPROX_PASTER(x,y) x ## _ ## y ## _approx_config
+
+#define DECL_APPROX_RECOVERY(scope, variable, elem_type, policy) \
+    approx_config_t VARIABLE_SCOPE_APPROX_PASTER(scope, variable) = { elem_type, policy, 0, 0 };
+
+#define DECL_APPROX_RECOVERY_EXTERN(scope, variable) \
+    extern approx_config_t VARIABLE_SCOPE_APPROX_PASTER(scope, variable);
+
+#define APPROX_RECOVERY_CONFIG(scope, variable) \
+    VARIABLE_SCOPE_APPROX_PASTER(scope, variable)
+
+#define APPROX_RECOVER(fname, variable, dueinfo) \
+    approx_recover(dueinfo, RECOVERY_ADDR(fname, variable), RECOVERY_END_ADDR(fname, variable), &APPROX_RECOVERY_CONFIG(fname, variable))
+
+extern approx_stats_t g_approx_stats;
+
+size_t approx_elem_size(approx_elem_type_t type);
+double approx_decode_element(const unsigned char* bytes, approx_elem_type_t type);
+int approx_is_finite(double v);
+unsigned long approx_assemble_line(const dueinfo_t* dueinfo, unsigned char* line, unsigned long* msg_addr);
+void approx_encode_element(unsigned char* bytes, double value, approx_elem_type_t type);
+int approx_recover(dueinfo_t* dueinfo, void* var_start, void* var_end, const approx_config_t* config);
+int approx_recovery_benchmark(void* var_start, void* var_end, approx_elem_type_t type, size_t msg_size, size_t trials, unsigned long seed, approx_benchmark_t* result);
+void dump_approx_stats();
+void dump_approx_benchmark(const approx_benchmark_t* result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,387 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_adaptive.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int g_due_adaptive_enabled = 0;
+due_adaptive_stats_t g_due_adaptive_stats;
+
+static due_adaptive_config_t g_adaptive_config = { DUE_ADAPTIVE_DEFAULT_HALF_LIFE, DUE_ADAPTIVE_DEFAULT_UP, DUE_ADAPTIVE_DEFAULT_DOWN, DUE_ADAPTIVE_DEFAULT_RANGE_UP, DUE_ADAPTIVE_DEFAULT_RANGE_DOWN, DUE_ADAPTIVE_DEFAULT_MIN_DWELL, DUE_ADAPTIVE_AUTO };
+static due_region_t* g_adaptive_regions[MAX_ADAPTIVE_REGIONS]; //Embedded region of each descriptor, sorted by pc_start
+static int g_adaptive_region_parents[MAX_ADAPTIVE_REGIONS];
+static size_t g_num_adaptive_regions = 0;
+static due_adaptive_range_t g_adaptive_ranges[MAX_ADAPTIVE_RANGES];
+static size_t g_num_hot_ranges = 0;
+static due_adaptive_event_t g_adaptive_log[DUE_ADAPTIVE_LOG_SIZE];
+
+static const char* g_due_granularity_names[DUE_GRANULARITY_NUM] = { "coarse", "fine" };
+static const char* g_due_adaptive_reason_names[DUE_ADAPTIVE_REASON_NUM] = { "region rate", "range rate", "forced" };
+
+//Collects the regions described by BEGIN_ADAPTIVE_DUE_RECOVERY from the due_adaptive_regions linker section and sorts them by start PC
+__attribute__((constructor)) void init_due_adaptive_regions() {
+    static int init = 0;
+    if (init)
+        return;
+    init = 1;
+    g_num_adaptive_regions = 0;
+    if (!__start_due_adaptive_regions || !__stop_due_adaptive_regions)
+        return;
+    for (due_adaptive_region_t** it = __start_due_adaptive_regions; it < __stop_due_adaptive_regions; it++) {
+        if (g_num_adaptive_regions >= MAX_ADAPTIVE_REGIONS) {
+            printf("Failed to add adaptive DUE region %s, MAX_ADAPTIVE_REGIONS has been exceeded.\n", (*it)->region.name);
+            break;
+        }
+        size_t i = g_num_adaptive_regions;
+        while (i > 0 && due_region_before(&((*it)->region), g_adaptive_regions[i-1])) {
+            g_adaptive_regions[i] = g_adaptive_regions[i-1];
+            i--;
+        }
+        g_adaptive_regions[i] = &((*it)->region);
+        g_num_adaptive_regions++;
+    }
+    due_region_table_link(g_adaptive_regions, g_adaptive_region_parents, g_num_adaptive_regions);
+}
+
+//The region is the first member of its descriptor
+static DUE_HANDLER_TEXT due_adaptive_region_t* due_adaptive_desc(due_region_t* region) {
+    return (due_adaptive_region_t*)region;
+}
+
+//Brings the tables and descriptors that due_adaptive_note() uses in ahead of the first DUE, see memory_due_init()
+int due_adaptive_prefault(int flags) {
+    int rc = 0;
+    init_due_adaptive_regions();
+    rc |= memory_due_prefault(g_adaptive_regions, g_num_adaptive_regions*sizeof(due_region_t*), 0, flags);
+    rc |= memory_due_prefault(g_adaptive_region_parents, g_num_adaptive_regions*sizeof(int), 0, flags);
+    rc |= memory_due_prefault(g_adaptive_ranges, sizeof(g_adaptive_ranges), 1, flags);
+    rc |= memory_due_prefault(g_adaptive_log, sizeof(g_adaptive_log), 1, flags);
+    rc |= memory_due_prefault(&g_adaptive_config, sizeof(g_adaptive_config), 0, flags);
+    rc |= memory_due_prefault(&g_due_adaptive_stats, sizeof(g_due_adaptive_stats), 1, flags);
+    for (size_t i = 0; i < g_num_adaptive_regions; i++)
+        rc |= memory_due_prefault(due_adaptive_desc(g_adaptive_regions[i]), sizeof(due_adaptive_region_t), 1, flags);
+    return rc;
+}
+
+void due_adaptive_config_init(due_adaptive_config_t* config) {
+    if (!config)
+        return;
+    config->half_life_ticks = DUE_ADAPTIVE_DEFAULT_HALF_LIFE;
+    config->up_threshold = DUE_ADAPTIVE_DEFAULT_UP;
+    config->down_threshold = DUE_ADAPTIVE_DEFAULT_DOWN;
+    config->range_up_threshold = DUE_ADAPTIVE_DEFAULT_RANGE_UP;
+    config->range_down_threshold = DUE_ADAPTIVE_DEFAULT_RANGE_DOWN;
+    config->min_dwell_ticks = DUE_ADAPTIVE_DEFAULT_MIN_DWELL;
+    config->mode = DUE_ADAPTIVE_AUTO;
+}
+
+//Halves the score once per elapsed half-life. Whole half-lives only, the remainder carries over to the next call.
+static DUE_HANDLER_TEXT unsigned long due_rate_decay(due_rate_t* rate, unsigned long now) {
+    if (rate->last_tick == 0 || now < rate->last_tick || g_adaptive_config.half_life_ticks == 0) {
+        rate->last_tick = now;
+        return rate->score;
+    }
+    unsigned long halvings = (now - rate->last_tick) / g_adaptive_config.half_life_ticks;
+    if (halvings >= 8*sizeof(unsigned long)) {
+        rate->score = 0;
+        rate->last_tick = now;
+    } else if (halvings > 0) {
+        rate->score >>= halvings;
+        rate->last_tick += halvings * g_adaptive_config.half_life_ticks;
+    }
+    return rate->score;
+}
+
+static DUE_HANDLER_TEXT void due_adaptive_log(const due_adaptive_region_t* r, due_granularity_t to, due_adaptive_reason_t reason, unsigned long range, unsigned long score, unsigned long now) {
+    due_adaptive_event_t* e = g_adaptive_log + (g_due_adaptive_stats.events & (DUE_ADAPTIVE_LOG_SIZE-1));
+    e->tick = now;
+    e->name = r->region.name;
+    e->range = range;
+    e->score = score;
+    e->to = to;
+    e->reason = reason;
+    g_due_adaptive_stats.events++;
+}
+
+//Sets the granularity that the mode, the region's own rate and the hot ranges call for
+static DUE_HANDLER_TEXT void due_adaptive_apply(due_adaptive_region_t* r, due_adaptive_reason_t reason, unsigned long range, unsigned long score, unsigned long now) {
+    int fine = 0;
+    if (g_due_adaptive_enabled && g_adaptive_config.mode == DUE_ADAPTIVE_FORCE_FINE)
+        fine = 1;
+    else if (g_due_adaptive_enabled && g_adaptive_config.mode == DUE_ADAPTIVE_AUTO)
+        fine = (r->hot || g_num_hot_ranges > 0);
+    if (fine == r->fine)
+        return;
+    if (r->fine && now > r->switch_tick)
+        r->ticks_fine += now - r->switch_tick;
+    r->fine = fine;
+    r->switch_tick = now;
+    r->transitions[fine]++;
+    g_due_adaptive_stats.switches[fine]++;
+    due_adaptive_log(r, (due_granularity_t)fine, reason, range, score, now);
+}
+
+static DUE_HANDLER_TEXT void due_adaptive_apply_all(due_adaptive_reason_t reason, unsigned long range, unsigned long score, unsigned long now) {
+    for (size_t i = 0; i < g_num_adaptive_regions; i++)
+        due_adaptive_apply(due_adaptive_desc(g_adaptive_regions[i]), reason, range, score, now);
+}
+
+void due_adaptive_enable(const due_adaptive_config_t* config) {
+    init_due_adaptive_regions();
+    if (config)
+        g_adaptive_config = *config;
+    if (g_adaptive_config.down_threshold > g_adaptive_config.up_threshold) //No hysteresis is the most that makes sense
+        g_adaptive_config.down_threshold = g_adaptive_config.up_threshold;
+    if (g_adaptive_config.range_down_threshold > g_adaptive_config.range_up_threshold)
+        g_adaptive_config.range_down_threshold = g_adaptive_config.range_up_threshold;
+    g_due_adaptive_enabled = 1;
+    due_adaptive_apply_all(DUE_ADAPTIVE_REASON_FORCED, 0, 0, get_sim_tick_counter());
+}
+
+//Every adaptive region goes back to coarse mode and stops tracking DUE rates
+void due_adaptive_disable() {
+    g_due_adaptive_enabled = 0;
+    due_adaptive_apply_all(DUE_ADAPTIVE_REASON_FORCED, 0, 0, get_sim_tick_counter());
+}
+
+//Innermost adaptive region containing pc, or NULL
+static DUE_HANDLER_TEXT due_adaptive_region_t* due_adaptive_find(void* pc) {
+    due_region_t* region = due_region_table_find(g_adaptive_regions, g_adaptive_region_parents, g_num_adaptive_regions, pc);
+    return (region ? due_adaptive_desc(region) : NULL);
+}
+
+//Open addressing on the range number. A new range takes the first slot on its probe path whose range is cold and has decayed to
+//nothing, else the first empty slot. Reused slots are never emptied, so no other range's probe path is cut short. When every slot
+//is taken by a live range, the new range is simply not tracked.
+static DUE_HANDLER_TEXT due_adaptive_range_t* due_adaptive_range(unsigned long base, unsigned long now) {
+    size_t h = (size_t)((base / DUE_ADAPTIVE_RANGE_SIZE) * 0x9e3779b97f4a7c15UL >> 32) & (MAX_ADAPTIVE_RANGES-1);
+    due_adaptive_range_t* stale = NULL;
+    due_adaptive_range_t* slot = NULL;
+    for (size_t probe = 0; probe < MAX_ADAPTIVE_RANGES; probe++) {
+        due_adaptive_range_t* p = g_adaptive_ranges + ((h+probe) & (MAX_ADAPTIVE_RANGES-1));
+        if (p->base == base)
+            return p;
+        if (p->base == 0) {
+            slot = p;
+            break;
+        }
+        if (!stale && !p->hot && due_rate_decay(&(p->rate), now) == 0)
+            stale = p;
+    }
+    if (stale) {
+        slot = stale;
+        g_due_adaptive_stats.reclaimed_ranges++;
+    }
+    if (slot) {
+        memset(slot, 0, sizeof(*slot));
+        slot->base = base;
+    }
+    return slot;
+}
+
+//Called from memory_due_handler_entry() for every DUE, before it looks for a handler, in trap context. DUEs that end up with no
+//handler at all still count, since in coarse mode those are exactly the ones in subroutines of adaptive regions.
+DUE_HANDLER_TEXT void due_adaptive_note(trapframe_t* tf, void* pushed_pc_start) {
+    if (!tf)
+        return;
+    unsigned long now = get_sim_tick_counter();
+    g_due_adaptive_stats.notes++;
+
+    //A DUE in a subroutine of a fine-grained region is charged to that region through its pushed handler. In a leaf subroutine of
+    //a coarse region the return address still points into the caller's region, deeper subroutines are only caught by range rates.
+    due_adaptive_region_t* r = due_adaptive_find((void*)(tf->epc));
+    if (!r && pushed_pc_start)
+        r = due_adaptive_find(pushed_pc_start);
+    if (!r)
+        r = due_adaptive_find((void*)(tf->gpr[1])); //gpr[1] is ra
+    if (r) {
+        r->dues++;
+        unsigned long score = due_rate_decay(&(r->rate), now) + DUE_ADAPTIVE_SCALE;
+        r->rate.score = score;
+        if (!r->hot && score >= g_adaptive_config.up_threshold) {
+            r->hot = 1;
+            r->hot_tick = now;
+            due_adaptive_apply(r, DUE_ADAPTIVE_REASON_REGION_RATE, 0, score, now);
+        }
+    } else
+        g_due_adaptive_stats.unmatched_dues++;
+
+    unsigned long base = ((unsigned long)(tf->badvaddr) & ~(DUE_ADAPTIVE_RANGE_SIZE-1)) | 1; //Low bit set so that range 0 is not mistaken for an unused slot
+    due_adaptive_range_t* range = due_adaptive_range(base, now);
+    if (!range) {
+        g_due_adaptive_stats.untracked_ranges++;
+        return;
+    }
+    range->dues++;
+    unsigned long score = due_rate_decay(&(range->rate), now) + DUE_ADAPTIVE_SCALE;
+    range->rate.score = score;
+    if (!range->hot && score >= g_adaptive_config.range_up_threshold) {
+        range->hot = 1;
+        range->hot_tick = now;
+        g_num_hot_ranges++;
+        due_adaptive_apply_all(DUE_ADAPTIVE_REASON_RANGE_RATE, base & ~1UL, score, now);
+    }
+}
+
+//Decays every rate to now and switches regions back to coarse mode once their rates have fallen. Cheap when nothing is hot.
+void due_adaptive_poll() {
+    if (!g_due_adaptive_enabled)
+        return;
+    unsigned long now = get_sim_tick_counter();
+    g_due_adaptive_stats.polls++;
+    for (size_t i = 0; i < MAX_ADAPTIVE_RANGES; i++) {
+        due_adaptive_range_t* range = g_adaptive_ranges+i;
+        if (range->base == 0 || !range->hot)
+            continue;
+        unsigned long score = due_rate_decay(&(range->rate), now);
+        if (score < g_adaptive_config.range_down_threshold && now - range->hot_tick >= g_adaptive_config.min_dwell_ticks) {
+            range->hot = 0;
+            g_num_hot_ranges--;
+            if (g_num_hot_ranges == 0)
+                due_adaptive_apply_all(DUE_ADAPTIVE_REASON_RANGE_RATE, range->base & ~1UL, score, now);
+        }
+    }
+    for (size_t i = 0; i < g_num_adaptive_regions; i++) {
+        due_adaptive_region_t* r = due_adaptive_desc(g_adaptive_regions[i]);
+        if (!r->hot)
+            continue;
+        unsigned long score = due_rate_decay(&(r->rate), now);
+        if (score < g_adaptive_config.down_threshold && now - r->hot_tick >= g_adaptive_config.min_dwell_ticks) {
+            r->hot = 0;
+            due_adaptive_apply(r, DUE_ADAPTIVE_REASON_REGION_RATE, 0, score, now);
+        }
+    }
+}
+
+static int DUE_RECOVERY_HANDLER(due_adaptive_benchmark, 1, dueinfo_t* recovery_context) {
+    return 1;
+}
+
+static int DUE_RECOVERY_HANDLER(due_adaptive_benchmark, 2, dueinfo_t* recovery_context) {
+    return 1;
+}
+
+static int DUE_RECOVERY_HANDLER(due_adaptive_benchmark, 3, dueinfo_t* recovery_context) {
+    return 1;
+}
+
+static volatile unsigned long g_adaptive_bench_data[64];
+
+//One region per function, so that the computed gotos of one region never appear to reach another
+__attribute__((noinline)) static unsigned long due_adaptive_benchmark_bare(unsigned long iterations) {
+    unsigned long sink = 0;
+    for (unsigned long i = 0; i < iterations; i++)
+        sink += g_adaptive_bench_data[i & 63];
+    return sink;
+}
+
+__attribute__((noinline)) static unsigned long due_adaptive_benchmark_pushed(unsigned long iterations) {
+    unsigned long sink = 0;
+    for (unsigned long i = 0; i < iterations; i++) {
+        BEGIN_DUE_RECOVERY(due_adaptive_benchmark, 1, STRICTNESS_DEFAULT)
+        sink += g_adaptive_bench_data[i & 63];
+        END_DUE_RECOVERY(due_adaptive_benchmark, 1)
+    }
+    return sink;
+}
+
+__attribute__((noinline)) static unsigned long due_adaptive_benchmark_coarse(unsigned long iterations) {
+    static due_adaptive_region_t DUE_ADAPTIVE_DESC(due_adaptive_benchmark, 2) = DUE_ADAPTIVE_REGION_INIT(due_adaptive_benchmark, 2, STRICTNESS_DEFAULT);
+    unsigned long sink = 0;
+    for (unsigned long i = 0; i < iterations; i++) {
+        ADAPTIVE_DUE_ENTER(due_adaptive_benchmark, 2, STRICTNESS_DEFAULT)
+        sink += g_adaptive_bench_data[i & 63];
+        END_ADAPTIVE_DUE_RECOVERY(due_adaptive_benchmark, 2)
+    }
+    return sink;
+}
+
+__attribute__((noinline)) static unsigned long due_adaptive_benchmark_fine(unsigned long iterations) {
+    static due_adaptive_region_t DUE_ADAPTIVE_DESC(due_adaptive_benchmark, 3) = DUE_ADAPTIVE_REGION_INIT(due_adaptive_benchmark, 3, STRICTNESS_DEFAULT);
+    unsigned long sink = 0;
+    DUE_ADAPTIVE_DESC(due_adaptive_benchmark, 3).fine = 1;
+    for (unsigned long i = 0; i < iterations; i++) {
+        ADAPTIVE_DUE_ENTER(due_adaptive_benchmark, 3, STRICTNESS_DEFAULT)
+        sink += g_adaptive_bench_data[i & 63];
+        END_ADAPTIVE_DUE_RECOVERY(due_adaptive_benchmark, 3)
+    }
+    return sink;
+}
+
+//Steady-state cost of protecting a small loop body on a fault-free run. The adaptive descriptors here are deliberately kept out of the
+//linker sections, so they never take part in real DUE handling.
+int due_adaptive_benchmark(unsigned long iterations, due_adaptive_benchmark_t* result) {
+    if (!result || iterations == 0)
+        return -4;
+    volatile unsigned long sink = 0;
+    memset(result, 0, sizeof(*result));
+    result->iterations = iterations;
+
+    unsigned long start = get_sim_tick_counter();
+    sink += due_adaptive_benchmark_bare(iterations);
+    result->ticks_bare = get_sim_tick_counter() - start;
+
+    start = get_sim_tick_counter();
+    sink += due_adaptive_benchmark_pushed(iterations);
+    result->ticks_pushed = get_sim_tick_counter() - start;
+
+    start = get_sim_tick_counter();
+    sink += due_adaptive_benchmark_coarse(iterations);
+    result->ticks_coarse = get_sim_tick_counter() - start;
+
+    start = get_sim_tick_counter();
+    sink += due_adaptive_benchmark_fine(iterations);
+    result->ticks_fine = get_sim_tick_counter() - start;
+
+    (void)sink;
+    return 0;
+}
+
+const char* due_granularity_name(due_granularity_t granularity) {
+    return (granularity < DUE_GRANULARITY_NUM ? g_due_granularity_names[granularity] : "invalid");
+}
+
+void dump_due_adaptive_stats() {
+    unsigned long now = get_sim_tick_counter();
+    printf("Adaptive DUE regions: %lu, %s, mode %s\n", g_num_adaptive_regions, (g_due_adaptive_enabled ? "enabled" : "disabled"), (g_adaptive_config.mode == DUE_ADAPTIVE_AUTO ? "auto" : (g_adaptive_config.mode == DUE_ADAPTIVE_FORCE_FINE ? "forced fine" : "forced coarse")));
+    printf("DUEs noted: %lu, outside adaptive regions: %lu, in untracked ranges: %lu\n", g_due_adaptive_stats.notes, g_due_adaptive_stats.unmatched_dues, g_due_adaptive_stats.untracked_ranges);
+    printf("Range slots reclaimed from decayed ranges: %lu\n", g_due_adaptive_stats.reclaimed_ranges);
+    printf("Polls: %lu\n", g_due_adaptive_stats.polls);
+    printf("Switches to coarse: %lu, to fine: %lu\n", g_due_adaptive_stats.switches[DUE_GRANULARITY_COARSE], g_due_adaptive_stats.switches[DUE_GRANULARITY_FINE]);
+    for (size_t i = 0; i < g_num_adaptive_regions; i++) {
+        const due_adaptive_region_t* r = due_adaptive_desc(g_adaptive_regions[i]);
+        unsigned long ticks_fine = r->ticks_fine + (r->fine && now > r->switch_tick ? now - r->switch_tick : 0);
+        printf("Region %s: %s, rate %lu/%d, DUEs %lu, fine executions %lu, ticks fine %lu, switches to coarse %lu, to fine %lu\n", r->region.name, g_due_granularity_names[r->fine ? DUE_GRANULARITY_FINE : DUE_GRANULARITY_COARSE], r->rate.score, DUE_ADAPTIVE_SCALE, r->dues, r->fine_executions, ticks_fine, r->transitions[DUE_GRANULARITY_COARSE], r->transitions[DUE_GRANULARITY_FINE]);
+    }
+    printf("Hot memory ranges: %lu\n", g_num_hot_ranges);
+    for (size_t i = 0; i < MAX_ADAPTIVE_RANGES; i++) {
+        const due_adaptive_range_t* range = g_adaptive_ranges+i;
+        if (range->base != 0)
+            printf("Range %p: %s, rate %lu/%d, DUEs %lu\n", (void*)(range->base & ~1UL), (range->hot ? "hot" : "cold"), range->rate.score, DUE_ADAPTIVE_SCALE, range->dues);
+    }
+    unsigned long first = (g_due_adaptive_stats.events > DUE_ADAPTIVE_LOG_SIZE ? g_due_adaptive_stats.events - DUE_ADAPTIVE_LOG_SIZE : 0);
+    for (unsigned long e = first; e < g_due_adaptive_stats.events; e++) {
+        const due_adaptive_event_t* ev = g_adaptive_log + (e & (DUE_ADAPTIVE_LOG_SIZE-1));
+        printf("Switch %lu at tick %lu: %s to %s (%s", e, ev->tick, ev->name, g_due_granularity_names[ev->to], g_due_adaptive_reason_names[ev->reason]);
+        if (ev->reason == DUE_ADAPTIVE_REASON_RANGE_RATE)
+            printf(" of %p", (void*)(ev->range));
+        printf(", %lu/%d)\n", ev->score, DUE_ADAPTIVE_SCALE);
+    }
+}
+
+void dump_due_adaptive_benchmark(const due_adaptive_benchmark_t* result) {
+    double n = (double)(result->iterations);
+    printf("Adaptive granularity benchmark: %lu fault-free iterations\n", result->iterations);
+    printf("No region: %f ticks per iteration\n", (double)(result->ticks_bare) / n);
+    printf("Pushed region: %f ticks per iteration\n", (double)(result->ticks_pushed) / n);
+    printf("Adaptive region, coarse: %f ticks per iteration\n", (double)(result->ticks_coarse) / n);
+    printf("Adaptive region, fine: %f ticks per iteration\n", (double)(result->ticks_fine) / n);
+    if (result->ticks_pushed > result->ticks_bare)
+        printf("Pushed region overhead saved by coarse mode: %f%%\n", (double)((long)(result->ticks_pushed) - (long)(result->ticks_coarse)) * 100 / (double)(result->ticks_pushed - result->ticks_bare));
+}
@@ -0,0 +1,181 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Adaptive region granularity. A region opened with BEGIN_ADAPTIVE_DUE_RECOVERY is always described in the static region
+ * table, so in coarse mode it costs one load and branch per execution and DUEs are found by PC. Once DUEs start arriving,
+ * either in the region itself or anywhere in a memory range, it switches to fine mode and pushes its handler like
+ * BEGIN_DUE_RECOVERY, which also covers DUEs in its subroutines. DUE rates decay exponentially, and a region goes back to
+ * coarse mode once its rate and every range's rate have fallen below a lower threshold for a minimum dwell time.
+ */
+
+#ifndef DUE_ADAPTIVE_H
+#define DUE_ADAPTIVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define MAX_ADAPTIVE_REGIONS MAX_STATIC_DUE_REGIONS
+#define MAX_ADAPTIVE_RANGES 64 //Must be a power of two
+#define DUE_ADAPTIVE_RANGE_SIZE (1UL << 20) //Bytes per tracked memory range, must be a power of two
+#define DUE_ADAPTIVE_SCALE 256 //Fixed-point DUE rates: each DUE adds DUE_ADAPTIVE_SCALE, which then halves every half-life
+#define DUE_ADAPTIVE_DEFAULT_HALF_LIFE 100000000UL
+#define DUE_ADAPTIVE_DEFAULT_UP (2*DUE_ADAPTIVE_SCALE)
+#define DUE_ADAPTIVE_DEFAULT_DOWN (DUE_ADAPTIVE_SCALE/4)
+#define DUE_ADAPTIVE_DEFAULT_RANGE_UP (4*DUE_ADAPTIVE_SCALE)
+#define DUE_ADAPTIVE_DEFAULT_RANGE_DOWN (DUE_ADAPTIVE_SCALE/4)
+#define DUE_ADAPTIVE_DEFAULT_MIN_DWELL 10000000UL
+#define DUE_ADAPTIVE_POLL_PERIOD 1024 //Executions of a fine-grained region between checks for switching back
+#define DUE_ADAPTIVE_LOG_SIZE 32 //Must be a power of two
+
+typedef enum {
+    DUE_GRANULARITY_COARSE, //Static table lookup only
+    DUE_GRANULARITY_FINE, //Handler pushed on every execution
+    DUE_GRANULARITY_NUM
+} due_granularity_t;
+
+typedef enum {
+    DUE_ADAPTIVE_AUTO,
+    DUE_ADAPTIVE_FORCE_COARSE,
+    DUE_ADAPTIVE_FORCE_FINE
+} due_adaptive_mode_t;
+
+typedef enum {
+    DUE_ADAPTIVE_REASON_REGION_RATE, //The region's own DUE rate crossed a threshold
+    DUE_ADAPTIVE_REASON_RANGE_RATE, //Some memory range's DUE rate crossed a threshold
+    DUE_ADAPTIVE_REASON_FORCED, //due_adaptive_enable() with a forced mode
+    DUE_ADAPTIVE_REASON_NUM
+} due_adaptive_reason_t;
+
+typedef struct {
+    unsigned long half_life_ticks;
+    unsigned long up_threshold; //Region rate, in DUE_ADAPTIVE_SCALE units, that switches it to fine mode
+    unsigned long down_threshold; //Region rate below which it may switch back
+    unsigned long range_up_threshold; //Range rate that switches every adaptive region to fine mode
+    unsigned long range_down_threshold;
+    unsigned long min_dwell_ticks; //Minimum time over a threshold before falling back below it counts
+    due_adaptive_mode_t mode;
+} due_adaptive_config_t;
+
+typedef struct {
+    unsigned long score;
+    unsigned long last_tick;
+} due_rate_t;
+
+typedef struct {
+    due_region_t region; //Always in the static region table
+    volatile int fine; //Read on every execution, written by the DUE path and by polls
+    int hot; //Own rate is over the threshold
+    due_rate_t rate;
+    unsigned long hot_tick;
+    unsigned long switch_tick;
+    unsigned long dues;
+    unsigned long fine_executions; //Coarse executions are not counted, that would cost a store
+    unsigned long ticks_fine;
+    unsigned long transitions[DUE_GRANULARITY_NUM]; //Switches into each granularity
+} due_adaptive_region_t;
+
+typedef struct {
+    unsigned long base; //Range address, 0 if unused
+    due_rate_t rate;
+    int hot;
+    unsigned long hot_tick;
+    unsigned long dues;
+} due_adaptive_range_t;
+
+typedef struct {
+    unsigned long tick;
+    const char* name; //Region that switched
+    unsigned long range; //Range that triggered it, for DUE_ADAPTIVE_REASON_RANGE_RATE
+    unsigned long score;
+    due_granularity_t to;
+    due_adaptive_reason_t reason;
+} due_adaptive_event_t;
+
+typedef struct {
+    unsigned long notes;
+    unsigned long unmatched_dues; //DUEs outside every adaptive region
+    unsigned long untracked_ranges; //DUEs in ranges that did not fit in the table
+    unsigned long reclaimed_ranges; //Slots of cold, fully decayed ranges given to new ones
+    unsigned long polls;
+    unsigned long switches[DUE_GRANULARITY_NUM];
+    unsigned long events;
+} due_adaptive_stats_t;
+
+typedef struct {
+    unsigned long iterations;
+    unsigned long ticks_bare; //No recovery region
+    unsigned long ticks_pushed; //BEGIN_DUE_RECOVERY/END_DUE_RECOVERY
+    unsigned long ticks_coarse; //Adaptive region in coarse mode
+    unsigned long ticks_fine; //Adaptive region in fine mode
+} due_adaptive_benchmark_t;
+
+extern int g_due_adaptive_enabled;
+extern due_adaptive_stats_t g_due_adaptive_stats;
+extern due_adaptive_region_t* __start_due_adaptive_regions[] __attribute__((weak)); //Defined by the linker when any adaptive region exists
+extern due_adaptive_region_t* __stop_due_adaptive_regions[] __attribute__((weak));
+
+#define DUE_ADAPTIVE_DESC(fname, seqnum) fname ## _ ## seqnum ## _ ## adaptive
+#define DUE_ADAPTIVE_DESC_PTR(fname, seqnum) fname ## _ ## seqnum ## _ ## adaptive_ptr
+#define DUE_ADAPTIVE_PUSHED(fname, seqnum) fname ## _ ## seqnum ## _ ## pushed
+
+#define DUE_ADAPTIVE_REGION_INIT(fname, seqnum, strict) \
+    { { STRINGIFY(FUNCTION_DUE_RECOVERY_NAME(fname, seqnum)), FUNCTION_DUE_RECOVERY_NAME(fname, seqnum), strict, &&START_DUE_REGION_LABEL(fname, seqnum), &&END_DUE_REGION_LABEL(fname, seqnum), 0 } }
+
+//Opens a region whose descriptor already exists, see BEGIN_ADAPTIVE_DUE_RECOVERY. The granularity is latched on entry, so a switch
+//in the middle of the region never pops a handler that was not pushed.
+#define ADAPTIVE_DUE_ENTER(fname, seqnum, strict) \
+    int DUE_ADAPTIVE_PUSHED(fname, seqnum) = DUE_ADAPTIVE_DESC(fname, seqnum).fine; \
+    if (DUE_ADAPTIVE_PUSHED(fname, seqnum)) \
+        push_user_memory_due_trap_handler(STRINGIFY(FUNCTION_DUE_RECOVERY_NAME(fname, seqnum)), FUNCTION_DUE_RECOVERY_NAME(fname, seqnum), &&START_DUE_REGION_LABEL(fname, seqnum), &&END_DUE_REGION_LABEL(fname, seqnum), strict); \
+    START_DUE_REGION_LABEL(fname,seqnum):;
+
+//Drop-in replacement for BEGIN_DUE_RECOVERY, with the same restrictions as BEGIN_STATIC_DUE_RECOVERY
+#define BEGIN_ADAPTIVE_DUE_RECOVERY(fname, seqnum, strict) \
+    static due_adaptive_region_t DUE_ADAPTIVE_DESC(fname, seqnum) = DUE_ADAPTIVE_REGION_INIT(fname, seqnum, strict); \
+    static due_region_t* const DUE_REGION_DESC_PTR(fname, seqnum) __attribute__((section("due_regions"), used)) = &(DUE_ADAPTIVE_DESC(fname, seqnum).region); \
+    static due_adaptive_region_t* const DUE_ADAPTIVE_DESC_PTR(fname, seqnum) __attribute__((section("due_adaptive_regions"), used)) = &DUE_ADAPTIVE_DESC(fname, seqnum); \
+    ADAPTIVE_DUE_ENTER(fname, seqnum, strict)
+
+#define END_ADAPTIVE_DUE_RECOVERY(fname,seqnum) \
+    END_DUE_REGION_LABEL(fname,seqnum):; \
+    if (DUE_ADAPTIVE_PUSHED(fname, seqnum)) { \
+        if (g_handler_stack[g_handler_sp].restart == 1) { \
+            g_handler_stack[g_handler_sp].restart = 0; \
+            printf("Restarting DUE trap region!\n"); \
+            goto *(g_handler_stack[g_handler_sp].pc_start); \
+        } \
+        pop_user_memory_due_trap_handler(); \
+        if (++(DUE_ADAPTIVE_DESC(fname, seqnum).fine_executions) % DUE_ADAPTIVE_POLL_PERIOD == 0) \
+            due_adaptive_poll(); \
+    } else if (DUE_ADAPTIVE_DESC(fname, seqnum).region.restart == 1) { \
+        DUE_ADAPTIVE_DESC(fname, seqnum).region.restart = 0; \
+        printf("Restarting DUE trap region!\n"); \
+        goto *(DUE_ADAPTIVE_DESC(fname, seqnum).region.pc_start); \
+    }
+
+//Call from the main loop when fine-grained regions may not run often enough to notice that DUE rates have fallen
+#define DUE_ADAPTIVE_POLL() \
+    due_adaptive_poll();
+
+void init_due_adaptive_regions();
+void due_adaptive_config_init(due_adaptive_config_t* config);
+void due_adaptive_enable(const due_adaptive_config_t* config);
+void due_adaptive_disable();
+int due_adaptive_prefault(int flags);
+void due_adaptive_note(trapframe_t* tf, void* pushed_pc_start);
+void due_adaptive_poll();
+int due_adaptive_benchmark(unsigned long iterations, due_adaptive_benchmark_t* result);
+const char* due_granularity_name(due_granularity_t granularity);
+void dump_due_adaptive_stats();
+void dump_due_adaptive_benchmark(const due_adaptive_benchmark_t* result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
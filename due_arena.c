@@ -0,0 +1,98 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_arena.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+due_arena_t g_due_arenas[DUE_CLASS_NUM] = {
+    { DUE_ARENA_CACHELINE_SIZE, NULL, NULL, NULL, 0, 0, 0, 0, 0 },
+    { DUE_ARENA_MESSAGE_SIZE, NULL, NULL, NULL, 0, 0, 0, 0, 0 },
+    { DUE_ARENA_CACHELINE_SIZE, NULL, NULL, NULL, 0, 0, 0, 0, 0 }
+};
+
+static const char* g_due_class_names[DUE_CLASS_NUM] = { "critical", "approximable", "custom" };
+
+static unsigned long due_arena_round_up(unsigned long x, size_t align) {
+    return (x + align-1) & ~((unsigned long)align-1);
+}
+
+//Alignment can only change while the arena is empty, or earlier allocations could end up sharing a boundary with later ones
+int due_arena_set_align(due_crit_class_t crit_class, size_t align) {
+    if (crit_class >= DUE_CLASS_NUM || align == 0 || (align & (align-1)) != 0 || align > DUE_ARENA_CHUNK_SIZE)
+        return -4;
+    if (g_due_arenas[crit_class].allocations > 0) {
+        printf("Failed to set alignment of %s arena, it is not empty.\n", g_due_class_names[crit_class]);
+        return -4;
+    }
+    g_due_arenas[crit_class].align = align;
+    return 0;
+}
+
+static int due_arena_grow(due_arena_t* arena, size_t size) {
+    size_t usable = (size > DUE_ARENA_CHUNK_SIZE ? size : DUE_ARENA_CHUNK_SIZE) + arena->align;
+    due_arena_chunk_t* chunk = (due_arena_chunk_t*)malloc(sizeof(due_arena_chunk_t) + usable);
+    if (!chunk) {
+        printf("Failed to grow DUE arena by %lu bytes\n", usable);
+        return -4;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = usable;
+    arena->chunks = chunk;
+    if (arena->bump)
+        arena->chunk_waste_bytes += (unsigned long)(arena->limit - arena->bump);
+    arena->reserved_bytes += sizeof(due_arena_chunk_t) + usable;
+    unsigned char* base = (unsigned char*)(chunk+1);
+    arena->bump = (unsigned char*)due_arena_round_up((unsigned long)base, arena->align);
+    arena->limit = base + usable;
+    return 0;
+}
+
+//Bump-pointer fast path: the start is already on a boundary, so only the size is rounded out
+void* due_arena_alloc(due_crit_class_t crit_class, size_t size) {
+    if (crit_class >= DUE_CLASS_NUM || size == 0)
+        return NULL;
+    due_arena_t* arena = g_due_arenas+crit_class;
+    size_t padded = due_arena_round_up(size, arena->align);
+    if (!arena->bump || (size_t)(arena->limit - arena->bump) < padded) {
+        if (due_arena_grow(arena, padded) != 0)
+            return NULL;
+    }
+    void* p = arena->bump;
+    arena->bump += padded;
+    arena->allocations++;
+    arena->requested_bytes += size;
+    arena->padding_bytes += padded - size;
+    return p;
+}
+
+void due_arena_reset(due_crit_class_t crit_class) {
+    if (crit_class >= DUE_CLASS_NUM)
+        return;
+    due_arena_t* arena = g_due_arenas+crit_class;
+    due_arena_chunk_t* chunk = arena->chunks;
+    while (chunk) {
+        due_arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    size_t align = arena->align;
+    memset(arena, 0, sizeof(*arena));
+    arena->align = align;
+}
+
+void dump_due_arena_stats() {
+    for (size_t c = 0; c < DUE_CLASS_NUM; c++) {
+        due_arena_t* arena = g_due_arenas+c;
+        unsigned long in_use = arena->requested_bytes + arena->padding_bytes;
+        printf("DUE arena %s (%lu-byte boundaries): %lu allocations, %lu bytes requested, %lu bytes padding, %lu bytes chunk waste, %lu bytes reserved", g_due_class_names[c], arena->align, arena->allocations, arena->requested_bytes, arena->padding_bytes, arena->chunk_waste_bytes, arena->reserved_bytes);
+        if (arena->requested_bytes > 0)
+            printf(", segregation overhead %f%%", (double)(in_use + arena->chunk_waste_bytes - arena->requested_bytes) * 100 / (double)(arena->requested_bytes));
+        printf("\n");
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Criticality-segregating arena allocators. Each criticality class gets its own bump-pointer arena, and allocations are
+ * padded to the class's boundary, so that one ECC message (or cacheline, for classes whose handlers use the whole line)
+ * never holds two variables with different recovery policies. Arenas are only ever reset as a whole.
+ */
+
+#ifndef DUE_ARENA_H
+#define DUE_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define DUE_ARENA_MESSAGE_SIZE 8
+#define DUE_ARENA_CACHELINE_SIZE 64
+#define DUE_ARENA_CHUNK_SIZE 65536
+
+typedef enum {
+    DUE_CLASS_CRITICAL, //Recovered from replicas or golden copies, or crash. Padded to cachelines.
+    DUE_CLASS_APPROXIMABLE, //Recovered from neighbors of the same type. Padded to messages.
+    DUE_CLASS_CUSTOM, //Application-specific handlers that may use the whole cacheline as side information. Padded to cachelines.
+    DUE_CLASS_NUM
+} due_crit_class_t;
+
+typedef struct due_arena_chunk {
+    struct due_arena_chunk* next;
+    size_t size; //Usable bytes after the header
+} due_arena_chunk_t;
+
+typedef struct {
+    size_t align; //Boundary that no two allocations may share
+    due_arena_chunk_t* chunks;
+    unsigned char* bump;
+    unsigned char* limit;
+    unsigned long allocations;
+    unsigned long requested_bytes;
+    unsigned long padding_bytes; //Lost to rounding allocations out to the boundary
+    unsigned long chunk_waste_bytes; //Left at the end of a chunk when a new one was started
+    unsigned long reserved_bytes; //Obtained from malloc()
+} due_arena_t;
+
+extern due_arena_t g_due_arenas[DUE_CLASS_NUM];
+
+#define DUE_ARENA_ALLOC(crit_class, size) \
+    due_arena_alloc(crit_class, size)
+
+//Allocates variable from its class's arena and registers it for recovery
+#define EN_RECOVERY_ARENA(scope, variable, crit_class, size) \
+    variable = due_arena_alloc(crit_class, size); \
+    EN_RECOVERY_PTR(scope, variable, size)
+
+int due_arena_set_align(due_crit_class_t crit_class, size_t align);
+void* due_arena_alloc(due_crit_class_t crit_class, size_t size);
+void due_arena_reset(due_crit_class_t crit_class);
+void dump_due_arena_stats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
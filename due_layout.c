@@ -0,0 +1,151 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_layout.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* g_due_field_policy_names[DUE_FIELD_POLICY_NUM] = { "crash", "system", "approx", "don't care", "custom" };
+
+int due_layout_build(due_layout_t* layout) {
+    if (!layout || !layout->fields || layout->stride == 0 || layout->num_fields >= DUE_LAYOUT_PADDING)
+        return -4;
+    unsigned short* map = (unsigned short*)malloc(layout->stride * sizeof(unsigned short));
+    if (!map) {
+        printf("Failed to build recovery layout %s, could not allocate %lu bytes\n", layout->name, layout->stride * sizeof(unsigned short));
+        return -4;
+    }
+    for (size_t b = 0; b < layout->stride; b++)
+        map[b] = DUE_LAYOUT_PADDING;
+    for (size_t f = 0; f < layout->num_fields; f++) {
+        const due_field_t* field = layout->fields+f;
+        size_t esize = approx_elem_size(field->type);
+        if (field->offset + field->size > layout->stride || field->policy >= DUE_FIELD_POLICY_NUM || (field->policy == DUE_FIELD_POLICY_CUSTOM && !field->handler)
+                || (field->policy == DUE_FIELD_POLICY_APPROX && (esize == 0 || field->size % esize != 0))) { //An approximable field is a whole number of elements
+            printf("Failed to build recovery layout %s, field %s is malformed\n", layout->name, field->name);
+            free(map);
+            return -4;
+        }
+        for (size_t b = field->offset; b < field->offset + field->size; b++) {
+            if (map[b] != DUE_LAYOUT_PADDING) { //Unions would need one policy for all their members
+                printf("Failed to build recovery layout %s, fields %s and %s overlap\n", layout->name, layout->fields[map[b]].name, field->name);
+                free(map);
+                return -4;
+            }
+            map[b] = (unsigned short)f;
+        }
+    }
+    due_layout_free(layout);
+    layout->byte_field = map;
+    return 0;
+}
+
+void due_layout_free(due_layout_t* layout) {
+    if (layout && layout->byte_field) {
+        free(layout->byte_field);
+        layout->byte_field = NULL;
+    }
+}
+
+//O(1): one division for the element, one table lookup for the field. NULL for padding or addresses outside the variable.
+const due_field_t* due_layout_resolve(const due_layout_t* layout, void* var_start, void* var_end, void* addr, size_t* elem_index) {
+    if (!layout || !layout->byte_field || (unsigned char*)addr < (unsigned char*)var_start || (unsigned char*)addr >= (unsigned char*)var_end)
+        return NULL;
+    size_t off = (size_t)((unsigned char*)addr - (unsigned char*)var_start);
+    unsigned short f = layout->byte_field[off % layout->stride];
+    if (elem_index)
+        *elem_index = off / layout->stride;
+    return (f == DUE_LAYOUT_PADDING ? NULL : layout->fields+f);
+}
+
+//Crash beats system recovery beats user recovery
+static int due_layout_combine(int mode, int field_mode) {
+    if (mode == -1 || field_mode == -1 || field_mode < -1)
+        return -1;
+    if (mode == 1 || field_mode == 1)
+        return 1;
+    return 0;
+}
+
+//Applies the policy of every field that the victim message overlaps, in every element it overlaps. Returns the recovery mode.
+int due_layout_recover(due_layout_t* layout, dueinfo_t* dueinfo, void* var_start, void* var_end) {
+    if (!layout || !layout->byte_field || !dueinfo || !dueinfo->valid || !var_start || !var_end)
+        return -1;
+    size_t msg_size = dueinfo->recovered_message.size;
+    if (msg_size == 0 || msg_size > MAX_WORD_SIZE)
+        return -1;
+    unsigned char* msg_addr = (unsigned char*)((unsigned long)(dueinfo->tf.badvaddr) - (unsigned long)(dueinfo->tf.badvaddr) % msg_size);
+    unsigned char* lo = (msg_addr > (unsigned char*)var_start ? msg_addr : (unsigned char*)var_start);
+    unsigned char* hi = (msg_addr + msg_size < (unsigned char*)var_end ? msg_addr + msg_size : (unsigned char*)var_end);
+
+    int mode = 0;
+    int any = 0;
+    for (unsigned char* a = lo; a < hi; ) {
+        size_t elem = 0;
+        const due_field_t* field = due_layout_resolve(layout, var_start, var_end, a, &elem);
+        if (!field) { //Padding holds nothing
+            a++;
+            continue;
+        }
+        unsigned char* elem_start = (unsigned char*)var_start + elem * layout->stride;
+        int field_mode = -1;
+        layout->hits[field->policy]++;
+        switch (field->policy) {
+            case DUE_FIELD_POLICY_CRASH:
+                field_mode = -1;
+                break;
+            case DUE_FIELD_POLICY_SYSTEM:
+                field_mode = 1;
+                break;
+            case DUE_FIELD_POLICY_DONT_CARE:
+                field_mode = 0;
+                break;
+            case DUE_FIELD_POLICY_APPROX: {
+                //The same field of every element is a strided array, which is exactly what approx_recover() walks. An array field is one
+                //such strided array per sub-element, and every sub-element that the victim message hit must be predicted.
+                size_t esize = approx_elem_size(field->type);
+                field_mode = 0;
+                for (size_t sub = 0; sub < field->size; sub += esize) {
+                    unsigned char* sub_start = elem_start + field->offset + sub;
+                    if (sub_start >= msg_addr + msg_size || sub_start + esize <= msg_addr)
+                        continue;
+                    approx_config_t config = { field->type, field->approx_policy, layout->stride, field->offset + sub };
+                    if (approx_recover(dueinfo, var_start, var_end, &config) != 0) {
+                        field_mode = 1;
+                        break;
+                    }
+                }
+                break;
+            }
+            case DUE_FIELD_POLICY_CUSTOM:
+                field_mode = field->handler(dueinfo, elem, field, elem_start);
+                break;
+            default:
+                break;
+        }
+        if (!any)
+            snprintf(dueinfo->expl, EXPL_SIZE, "DUE in %s element %lu field %s (%s), PC %p, bad addr %p\n", layout->name, elem, field->name, g_due_field_policy_names[field->policy], (void*)(dueinfo->tf.epc), (void*)(dueinfo->tf.badvaddr));
+        any = 1;
+        mode = due_layout_combine(mode, field_mode);
+        if (mode == -1)
+            break;
+        a = elem_start + field->offset + field->size; //Skip to the end of this field
+    }
+    return mode;
+}
+
+void dump_due_layout(const due_layout_t* layout) {
+    printf("Recovery layout %s: stride %lu bytes, %lu fields\n", layout->name, layout->stride, layout->num_fields);
+    for (size_t f = 0; f < layout->num_fields; f++) {
+        const due_field_t* field = layout->fields+f;
+        printf("Field %s: offset %lu, size %lu, policy %s\n", field->name, field->offset, field->size, (field->policy < DUE_FIELD_POLICY_NUM ? g_due_field_policy_names[field->policy] : "invalid"));
+    }
+    for (size_t p = 0; p < DUE_FIELD_POLICY_NUM; p++)
+        printf("DUEs in %s fields: %lu\n", g_due_field_policy_names[p], layout->hits[p]);
+}
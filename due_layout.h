@@ -0,0 +1,98 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Field-level layout descriptors for structs and arrays of structs registered for recovery. A layout gives the element stride
+ * and each field's offset, size, type and recovery policy, generated at compile time from the struct definition with
+ * DUE_FIELD(). A faulting address resolves to element index and field in O(1) through a byte-to-field map built at
+ * registration, and each field hit by the victim message gets its own policy.
+ */
+
+#ifndef DUE_LAYOUT_H
+#define DUE_LAYOUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+
+#define DUE_LAYOUT_PADDING 0xffff //Byte-to-field map entry for bytes that belong to no field
+
+typedef struct due_field due_field_t;
+
+typedef enum {
+    DUE_FIELD_POLICY_CRASH, //Correctness-critical, force a crash
+    DUE_FIELD_POLICY_SYSTEM, //Let the OS recover
+    DUE_FIELD_POLICY_APPROX, //Predict from the same field of neighboring elements, else let the OS recover
+    DUE_FIELD_POLICY_DONT_CARE, //Any value will do, keep the OS-recovered message
+    DUE_FIELD_POLICY_CUSTOM, //Call the field's own handler
+    DUE_FIELD_POLICY_NUM
+} due_field_policy_t;
+
+//Returns a recovery mode for a DUE in field of element elem_index
+typedef int (*due_field_handler_t)(dueinfo_t* dueinfo, size_t elem_index, const due_field_t* field, void* elem_start);
+
+struct due_field {
+    const char* name;
+    size_t offset;
+    size_t size;
+    approx_elem_type_t type;
+    due_field_policy_t policy;
+    approx_policy_t approx_policy; //For DUE_FIELD_POLICY_APPROX
+    due_field_handler_t handler; //For DUE_FIELD_POLICY_CUSTOM
+};
+
+typedef struct {
+    const char* name;
+    size_t stride; //Bytes per element, sizeof the struct
+    size_t num_fields;
+    const due_field_t* fields;
+    unsigned short* byte_field; //Field index of every byte of an element, built by due_layout_build()
+    unsigned long hits[DUE_FIELD_POLICY_NUM];
+} due_layout_t;
+
+#define VARIABLE_SCOPE_LAYOUT_PASTER(x,y) x ## _ ## y ## _layout
+#define VARIABLE_SCOPE_FIELDS_PASTER(x,y) x ## _ ## y ## _fields
+
+#define DUE_FIELD(struct_type, member, elem_type, policy) \
+    { #member, offsetof(struct_type, member), sizeof(((struct_type*)0)->member), elem_type, policy, APPROX_POLICY_LINEAR_INTERP, NULL }
+
+#define DUE_FIELD_APPROX(struct_type, member, elem_type, approx_policy) \
+    { #member, offsetof(struct_type, member), sizeof(((struct_type*)0)->member), elem_type, DUE_FIELD_POLICY_APPROX, approx_policy, NULL }
+
+#define DUE_FIELD_CUSTOM(struct_type, member, elem_type, handler) \
+    { #member, offsetof(struct_type, member), sizeof(((struct_type*)0)->member), elem_type, DUE_FIELD_POLICY_CUSTOM, APPROX_POLICY_LINEAR_INTERP, handler }
+
+//Fields are given as a list of DUE_FIELD(), DUE_FIELD_APPROX() and DUE_FIELD_CUSTOM()
+#define DECL_RECOVERY_LAYOUT(scope, variable, struct_type, ...) \
+    static const due_field_t VARIABLE_SCOPE_FIELDS_PASTER(scope, variable)[] = { __VA_ARGS__ }; \
+    due_layout_t VARIABLE_SCOPE_LAYOUT_PASTER(scope, variable) = { #struct_type, sizeof(struct_type), sizeof(VARIABLE_SCOPE_FIELDS_PASTER(scope, variable)) / sizeof(due_field_t), VARIABLE_SCOPE_FIELDS_PASTER(scope, variable), NULL };
+
+#define DECL_RECOVERY_LAYOUT_EXTERN(scope, variable) \
+    extern due_layout_t VARIABLE_SCOPE_LAYOUT_PASTER(scope, variable);
+
+#define RECOVERY_LAYOUT(scope, variable) \
+    VARIABLE_SCOPE_LAYOUT_PASTER(scope, variable)
+
+//Builds the byte-to-field map outside of trap context. Goes with EN_RECOVERY/EN_RECOVERY_PTR for the same variable.
+#define EN_RECOVERY_LAYOUT(scope, variable) \
+    due_layout_build(&RECOVERY_LAYOUT(scope, variable));
+
+//Evaluates to the recovery mode to use
+#define LAYOUT_RECOVER(fname, variable, dueinfo) \
+    due_layout_recover(&RECOVERY_LAYOUT(fname, variable), dueinfo, RECOVERY_ADDR(fname, variable), RECOVERY_END_ADDR(fname, variable))
+
+int due_layout_build(due_layout_t* layout);
+void due_layout_free(due_layout_t* layout);
+const due_field_t* due_layout_resolve(const due_layout_t* layout, void* var_start, void* var_end, void* addr, size_t* elem_index);
+int due_layout_recover(due_layout_t* layout, dueinfo_t* dueinfo, void* var_start, void* var_end);
+void dump_due_layout(const due_layout_t* layout);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
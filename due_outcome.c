@@ -0,0 +1,546 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_outcome.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char* g_outcome_class_names[OUTCOME_NUM] = { "crash", "exact", "tolerable", "sdc" };
+
+typedef struct {
+    char* site;
+    char* decision;
+    char* path;
+    int status;
+    outcome_result_t result;
+} outcome_run_t;
+
+typedef struct {
+    const char* site;
+    const char* decision;
+    unsigned long runs;
+    unsigned long classes[OUTCOME_NUM];
+    unsigned long bands[OUTCOME_MAX_BANDS];
+    unsigned long numeric_runs; //Runs with an output to measure, i.e., not crashes
+    double sum_max_rel_err;
+    double worst_max_rel_err;
+    double sum_psnr;
+    double sum_ssim;
+    double min_ssim;
+} outcome_group_t;
+
+static double outcome_abs(double v) {
+    return (v < 0 ? -v : v);
+}
+
+//Natural log from the IEEE exponent and an atanh series on the mantissa, so that no libm is needed
+static double outcome_log(double x) {
+    unsigned long bits;
+    memcpy(&bits, &x, sizeof(bits));
+    long e = (long)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & 0x000fffffffffffffUL) | 0x3ff0000000000000UL;
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+    double z = (m - 1) / (m + 1);
+    double z2 = z*z;
+    double term = z;
+    double sum = 0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= z2;
+    }
+    return 2*sum + (double)e * 0.69314718055994530942;
+}
+
+static double outcome_log10(double x) {
+    return outcome_log(x) / 2.30258509299404568402;
+}
+
+void outcome_config_init(outcome_config_t* config, approx_elem_type_t type) {
+    if (!config)
+        return;
+    memset(config, 0, sizeof(*config));
+    config->type = type;
+    config->metrics = OUTCOME_METRIC_ALL;
+    config->rel_floor = OUTCOME_DEFAULT_REL_FLOOR;
+    config->ssim_window = OUTCOME_DEFAULT_SSIM_WINDOW;
+}
+
+static double outcome_golden_range(const unsigned char* golden, size_t elems, size_t esize, approx_elem_type_t type) {
+    double lo = 0;
+    double hi = 0;
+    int any = 0;
+    for (size_t i = 0; i < elems; i++) {
+        double g = approx_decode_element(golden + i*esize, type);
+        if (!approx_is_finite(g))
+            continue;
+        if (!any || g < lo)
+            lo = g;
+        if (!any || g > hi)
+            hi = g;
+        any = 1;
+    }
+    return hi - lo;
+}
+
+static double outcome_ssim_window(double n, double sx, double sy, double sxx, double syy, double sxy, double c1, double c2) {
+    double mx = sx / n;
+    double my = sy / n;
+    double vx = sxx / n - mx*mx;
+    double vy = syy / n - my*my;
+    vx = (vx > 0 ? vx : 0); //Cancellation can leave a constant window's variance slightly negative
+    vy = (vy > 0 ? vy : 0);
+    double cxy = sxy / n - mx*my;
+    return ((2*mx*my + c1) * (2*cxy + c2)) / ((mx*mx + my*my + c1) * (vx + vy + c2));
+}
+
+//Single streaming pass over both outputs: O(1) state per comparison no matter how large the outputs are
+int outcome_compare(const outcome_config_t* config, const unsigned char* golden, size_t golden_size, const unsigned char* output, size_t output_size, outcome_result_t* result) {
+    if (!config || !result)
+        return -4;
+    size_t esize = approx_elem_size(config->type);
+    if (esize == 0)
+        return -4;
+    memset(result, 0, sizeof(*result));
+    if (!golden || !output || output_size != golden_size || golden_size % esize != 0) {
+        result->cls = OUTCOME_CRASH;
+        return 0;
+    }
+    size_t elems = golden_size / esize;
+    result->elems = elems;
+    if (memcmp(golden, output, golden_size) == 0) {
+        result->cls = OUTCOME_EXACT;
+        result->psnr = OUTCOME_MAX_PSNR;
+        result->ssim = 1;
+        return 0;
+    }
+
+    double peak = (config->peak > 0 ? config->peak : outcome_golden_range(golden, elems, esize, config->type));
+    if (!(peak > 0) || !approx_is_finite(peak)) //Constant golden output: c1 = c2 = 0 would make every SSIM window 0/0
+        peak = OUTCOME_FALLBACK_PEAK;
+    double c1 = (0.01*peak) * (0.01*peak);
+    double c2 = (0.03*peak) * (0.03*peak);
+    double floor = (config->rel_floor > 0 ? config->rel_floor : OUTCOME_DEFAULT_REL_FLOOR);
+    size_t window = (config->ssim_window > 0 ? config->ssim_window : OUTCOME_DEFAULT_SSIM_WINDOW);
+    double sse = 0;
+    double sum_rel = 0;
+    size_t finite = 0;
+    double sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0, wn = 0;
+    double ssim_sum = 0;
+    size_t windows = 0;
+    for (size_t i = 0; i < elems; i++) {
+        const unsigned char* gp = golden + i*esize;
+        const unsigned char* op = output + i*esize;
+        if (memcmp(gp, op, esize) != 0)
+            result->mismatched_elems++;
+        double g = approx_decode_element(gp, config->type);
+        double o = approx_decode_element(op, config->type);
+        if (!approx_is_finite(g) || !approx_is_finite(o)) {
+            if (memcmp(gp, op, esize) != 0)
+                result->nonfinite_mismatches++;
+            continue;
+        }
+        double err = outcome_abs(o - g);
+        if (config->metrics & OUTCOME_METRIC_RELERR) {
+            double rel = err / (outcome_abs(g) > floor ? outcome_abs(g) : floor);
+            if (rel > result->max_rel_err)
+                result->max_rel_err = rel;
+            sum_rel += rel;
+        }
+        sse += err*err;
+        finite++;
+        if (config->metrics & OUTCOME_METRIC_SSIM) {
+            sx += g;
+            sy += o;
+            sxx += g*g;
+            syy += o*o;
+            sxy += g*o;
+            wn++;
+            if (wn == (double)window) {
+                ssim_sum += outcome_ssim_window(wn, sx, sy, sxx, syy, sxy, c1, c2);
+                windows++;
+                sx = sy = sxx = syy = sxy = wn = 0;
+            }
+        }
+    }
+    if ((config->metrics & OUTCOME_METRIC_SSIM) && wn > 0) {
+        ssim_sum += outcome_ssim_window(wn, sx, sy, sxx, syy, sxy, c1, c2);
+        windows++;
+    }
+
+    result->mean_rel_err = (finite > 0 ? sum_rel / (double)finite : 0);
+    result->ssim = (windows > 0 ? ssim_sum / (double)windows : 1);
+    result->psnr = OUTCOME_MAX_PSNR;
+    if ((config->metrics & OUTCOME_METRIC_PSNR) && finite > 0 && sse > 0) {
+        result->psnr = 10 * outcome_log10(peak*peak / (sse / (double)finite));
+        if (result->psnr > OUTCOME_MAX_PSNR)
+            result->psnr = OUTCOME_MAX_PSNR;
+    }
+
+    result->cls = OUTCOME_SDC;
+    if (result->nonfinite_mismatches == 0 && (config->metrics & OUTCOME_METRIC_RELERR)) {
+        for (size_t b = 0; b < config->num_bands && b < OUTCOME_MAX_BANDS; b++) {
+            if (result->max_rel_err <= config->bands[b]) {
+                result->cls = OUTCOME_TOLERABLE;
+                result->band = b;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+//Read-only view of a whole file: mmap() on Linux, a malloc()ed copy elsewhere
+static const unsigned char* outcome_map(const char* path, size_t* size) {
+    *size = 0;
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *size = (size_t)st.st_size;
+    return (const unsigned char*)p;
+#else
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char* buf = (len > 0 ? (unsigned char*)malloc((size_t)len) : NULL);
+    if (!buf || fread(buf, 1, (size_t)len, fp) != (size_t)len) {
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    *size = (size_t)len;
+    return buf;
+#endif
+}
+
+static void outcome_unmap(const unsigned char* p, size_t size) {
+    if (!p)
+        return;
+#if defined(__linux__)
+    munmap((void*)p, size);
+#else
+    free((void*)p);
+#endif
+}
+
+static char* outcome_strdup(const char* s) {
+    size_t n = strlen(s);
+    char* d = (char*)malloc(n+1);
+    if (d)
+        memcpy(d, s, n+1);
+    return d;
+}
+
+static void outcome_free_runs(outcome_run_t* runs, size_t num_runs) {
+    for (size_t i = 0; i < num_runs; i++) {
+        free(runs[i].site);
+        free(runs[i].decision);
+        free(runs[i].path);
+    }
+    free(runs);
+}
+
+static outcome_run_t* outcome_read_manifest(const char* manifest_path, size_t* num_runs) {
+    *num_runs = 0;
+    FILE* fp = fopen(manifest_path, "r");
+    if (!fp) {
+        printf("Failed to open outcome manifest %s\n", manifest_path);
+        return NULL;
+    }
+    static char line[OUTCOME_MAX_LINE];
+    static char site[OUTCOME_MAX_LINE];
+    static char decision[OUTCOME_MAX_LINE];
+    static char path[OUTCOME_MAX_LINE];
+    size_t cap = 1024;
+    outcome_run_t* runs = (outcome_run_t*)malloc(cap * sizeof(outcome_run_t));
+    size_t lineno = 0;
+    while (runs && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char* hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        int status = 0;
+        int consumed = 0;
+        if (sscanf(line, "%s %s %d %n", site, decision, &status, &consumed) < 3) {
+            if (strspn(line, " \t\r\n") != strlen(line))
+                printf("Skipping malformed outcome manifest line %lu\n", lineno);
+            continue;
+        }
+        size_t plen = strcspn(line + consumed, "\r\n");
+        memcpy(path, line + consumed, plen);
+        path[plen] = '\0';
+        if (*num_runs == cap) {
+            cap *= 2;
+            outcome_run_t* grown = (outcome_run_t*)realloc(runs, cap * sizeof(outcome_run_t));
+            if (!grown) {
+                outcome_free_runs(runs, *num_runs);
+                runs = NULL;
+                break;
+            }
+            runs = grown;
+        }
+        outcome_run_t* r = runs + *num_runs;
+        memset(r, 0, sizeof(*r));
+        r->site = outcome_strdup(site);
+        r->decision = outcome_strdup(decision);
+        r->path = outcome_strdup(path);
+        r->status = status;
+        (*num_runs)++;
+        if (!r->site || !r->decision || !r->path) { //Later stages never expect a NULL string
+            outcome_free_runs(runs, *num_runs);
+            runs = NULL;
+            break;
+        }
+    }
+    fclose(fp);
+    if (!runs) {
+        *num_runs = 0;
+        printf("Failed to read outcome manifest %s, out of memory\n", manifest_path);
+    }
+    return runs;
+}
+
+typedef struct {
+    const outcome_config_t* config;
+    const unsigned char* golden;
+    size_t golden_size;
+    outcome_run_t* runs;
+    size_t num_runs;
+    volatile size_t next;
+    volatile unsigned long bytes;
+} outcome_work_t;
+
+static void outcome_classify_run(outcome_work_t* work, outcome_run_t* r) {
+    if (r->status != 0 || r->path[0] == '\0') {
+        memset(&(r->result), 0, sizeof(r->result));
+        r->result.cls = OUTCOME_CRASH;
+        return;
+    }
+    size_t size = 0;
+    const unsigned char* output = outcome_map(r->path, &size);
+    outcome_compare(work->config, work->golden, work->golden_size, output, size, &(r->result));
+    outcome_unmap(output, size);
+    __sync_fetch_and_add(&(work->bytes), (unsigned long)size);
+}
+
+//Runs are handed out one at a time from a shared counter, so slow outputs do not hold up a whole static partition
+static void* outcome_worker(void* arg) {
+    outcome_work_t* work = (outcome_work_t*)arg;
+    for (;;) {
+        size_t i = __sync_fetch_and_add(&(work->next), 1);
+        if (i >= work->num_runs)
+            break;
+        outcome_classify_run(work, work->runs+i);
+    }
+    return NULL;
+}
+
+static unsigned long outcome_hash(const char* site, const char* decision) {
+    unsigned long h = 1469598103934665603UL;
+    for (const char* s = site; *s; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211UL;
+    h = (h ^ 0xff) * 1099511628211UL;
+    for (const char* s = decision; *s; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211UL;
+    return h;
+}
+
+static int outcome_write_db(const outcome_config_t* config, const char* db_path, outcome_run_t* runs, size_t num_runs, unsigned long* num_groups) {
+    size_t slots = 16;
+    while (slots < 2*num_runs)
+        slots *= 2;
+    outcome_group_t* groups = (outcome_group_t*)calloc(num_runs > 0 ? num_runs : 1, sizeof(outcome_group_t));
+    long* table = (long*)malloc(slots * sizeof(long));
+    if (!groups || !table) {
+        free(groups);
+        free(table);
+        printf("Failed to write outcome database %s, out of memory\n", db_path);
+        return -4;
+    }
+    for (size_t i = 0; i < slots; i++)
+        table[i] = -1;
+
+    size_t n = 0;
+    for (size_t i = 0; i < num_runs; i++) {
+        outcome_run_t* r = runs+i;
+        size_t h = (size_t)outcome_hash(r->site, r->decision) & (slots-1);
+        while (table[h] >= 0 && (strcmp(groups[table[h]].site, r->site) != 0 || strcmp(groups[table[h]].decision, r->decision) != 0))
+            h = (h+1) & (slots-1);
+        if (table[h] < 0) {
+            table[h] = (long)n;
+            groups[n].site = r->site;
+            groups[n].decision = r->decision;
+            groups[n].min_ssim = 1;
+            n++;
+        }
+        outcome_group_t* g = groups + table[h];
+        g->runs++;
+        g->classes[r->result.cls]++;
+        if (r->result.cls == OUTCOME_TOLERABLE && r->result.band < OUTCOME_MAX_BANDS)
+            g->bands[r->result.band]++;
+        if (r->result.cls != OUTCOME_CRASH) {
+            g->numeric_runs++;
+            g->sum_max_rel_err += r->result.max_rel_err;
+            if (r->result.max_rel_err > g->worst_max_rel_err)
+                g->worst_max_rel_err = r->result.max_rel_err;
+            g->sum_psnr += r->result.psnr;
+            g->sum_ssim += r->result.ssim;
+            if (r->result.ssim < g->min_ssim)
+                g->min_ssim = r->result.ssim;
+        }
+    }
+
+    FILE* fp = fopen(db_path, "w");
+    if (!fp) {
+        printf("Failed to open outcome database %s for writing\n", db_path);
+        free(groups);
+        free(table);
+        return -4;
+    }
+    fprintf(fp, "site,decision,runs,crash,exact,tolerable,sdc");
+    for (size_t b = 0; b < config->num_bands && b < OUTCOME_MAX_BANDS; b++)
+        fprintf(fp, ",band_%g", config->bands[b]);
+    fprintf(fp, ",mean_max_rel_err,worst_max_rel_err,mean_psnr,mean_ssim,min_ssim\n");
+    for (size_t i = 0; i < n; i++) {
+        outcome_group_t* g = groups+i;
+        double m = (g->numeric_runs > 0 ? (double)(g->numeric_runs) : 1);
+        fprintf(fp, "%s,%s,%lu,%lu,%lu,%lu,%lu", g->site, g->decision, g->runs, g->classes[OUTCOME_CRASH], g->classes[OUTCOME_EXACT], g->classes[OUTCOME_TOLERABLE], g->classes[OUTCOME_SDC]);
+        for (size_t b = 0; b < config->num_bands && b < OUTCOME_MAX_BANDS; b++)
+            fprintf(fp, ",%lu", g->bands[b]);
+        fprintf(fp, ",%g,%g,%g,%g,%g\n", g->sum_max_rel_err / m, g->worst_max_rel_err, g->sum_psnr / m, g->sum_ssim / m, (g->numeric_runs > 0 ? g->min_ssim : 0.0));
+    }
+    fclose(fp);
+    free(groups);
+    free(table);
+    *num_groups = n;
+    return 0;
+}
+
+long outcome_classify_campaign(const outcome_config_t* config, const char* golden_path, const char* manifest_path, const char* db_path, outcome_campaign_stats_t* stats) {
+    if (!config || !golden_path || !manifest_path || !db_path)
+        return -4;
+    size_t esize = approx_elem_size(config->type);
+    if (esize == 0)
+        return -4;
+    unsigned long starttick = get_sim_tick_counter();
+
+    size_t golden_size = 0;
+    const unsigned char* golden = outcome_map(golden_path, &golden_size);
+    if (!golden) {
+        printf("Failed to open golden output %s\n", golden_path);
+        return -4;
+    }
+    size_t num_runs = 0;
+    outcome_run_t* runs = outcome_read_manifest(manifest_path, &num_runs);
+    if (!runs) {
+        outcome_unmap(golden, golden_size);
+        return -4;
+    }
+
+    //The golden range is needed by every comparison, so find it once up front
+    outcome_config_t local = *config;
+    if (local.peak <= 0)
+        local.peak = outcome_golden_range(golden, golden_size / esize, esize, config->type);
+
+    outcome_work_t work;
+    work.config = &local;
+    work.golden = golden;
+    work.golden_size = golden_size;
+    work.runs = runs;
+    work.num_runs = num_runs;
+    work.next = 0;
+    work.bytes = 0;
+#if defined(__linux__)
+    size_t threads = config->threads;
+    if (threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cores > 0 ? (size_t)cores : 1);
+    }
+    if (threads > num_runs)
+        threads = (num_runs > 0 ? num_runs : 1);
+    pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    size_t started = 0;
+    for (size_t t = 0; tids && t < threads; t++) {
+        if (pthread_create(tids+t, NULL, outcome_worker, &work) != 0)
+            break;
+        started++;
+    }
+    if (started == 0) //Could not start any threads, do it all here
+        outcome_worker(&work);
+    for (size_t t = 0; t < started; t++)
+        pthread_join(tids[t], NULL);
+    free(tids);
+#else
+    outcome_worker(&work);
+#endif
+
+    unsigned long num_groups = 0;
+    int rc = outcome_write_db(&local, db_path, runs, num_runs, &num_groups);
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->runs = num_runs;
+        for (size_t i = 0; i < num_runs; i++)
+            stats->classes[runs[i].result.cls]++;
+        stats->groups = num_groups;
+        stats->bytes_compared = work.bytes;
+        stats->elapsed_ticks = get_sim_tick_counter() - starttick;
+    }
+    outcome_free_runs(runs, num_runs);
+    outcome_unmap(golden, golden_size);
+    return (rc == 0 ? (long)num_runs : -4);
+}
+
+const char* outcome_class_name(outcome_class_t cls) {
+    if (cls < 0 || cls >= OUTCOME_NUM)
+        return "unknown";
+    return g_outcome_class_names[cls];
+}
+
+void dump_outcome_result(const outcome_result_t* result) {
+    printf("Outcome: %s", outcome_class_name(result->cls));
+    if (result->cls == OUTCOME_TOLERABLE)
+        printf(" (band %lu)", result->band);
+    printf("\n");
+    if (result->cls != OUTCOME_CRASH) {
+        printf("Elements: %lu, mismatched: %lu, non-finite mismatches: %lu\n", result->elems, result->mismatched_elems, result->nonfinite_mismatches);
+        printf("Max relative error: %g, mean relative error: %g\n", result->max_rel_err, result->mean_rel_err);
+        printf("PSNR: %f dB, SSIM: %f\n", result->psnr, result->ssim);
+    }
+}
+
+void dump_outcome_campaign_stats(const outcome_campaign_stats_t* stats) {
+    printf("Campaign runs: %lu\n", stats->runs);
+    for (size_t c = 0; c < OUTCOME_NUM; c++)
+        printf("Outcome %s: %lu\n", g_outcome_class_names[c], stats->classes[c]);
+    printf("Site/decision groups: %lu\n", stats->groups);
+    printf("Bytes compared: %lu\n", stats->bytes_compared);
+    printf("Elapsed ticks: %lu\n", stats->elapsed_ticks);
+}
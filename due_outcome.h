@@ -0,0 +1,90 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Outcome classification for DUE injection campaigns. Each run's output is streamed against a golden output with pluggable
+ * metrics (exact match, relative error, PSNR, SSIM-style windows, tolerance bands) and classified. Whole campaigns are
+ * described by a manifest, compared in parallel over memory-mapped outputs on host Linux builds, and summarized per
+ * injection site and handler decision in a CSV results database.
+ *
+ * Manifest format, one run per line, '#' starts a comment:
+ *   <site> <decision> <exit status> <output path>
+ * A nonzero exit status or a missing output counts as a crash.
+ */
+
+#ifndef DUE_OUTCOME_H
+#define DUE_OUTCOME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+
+#define OUTCOME_MAX_BANDS 8
+#define OUTCOME_MAX_LINE 4096
+#define OUTCOME_MAX_PSNR 200.0 //Reported for outputs that match exactly
+#define OUTCOME_DEFAULT_SSIM_WINDOW 64
+#define OUTCOME_DEFAULT_REL_FLOOR 1e-9
+#define OUTCOME_FALLBACK_PEAK 1.0 //Dynamic range used when the golden output is constant, so that SSIM and PSNR stay finite
+
+//Metrics, OR them together. Exact match is always checked first, because it settles most runs of a campaign with one memcmp().
+//The tolerance bands are thresholds on the relative error, so without OUTCOME_METRIC_RELERR every inexact run is SDC.
+#define OUTCOME_METRIC_RELERR 0x1
+#define OUTCOME_METRIC_PSNR 0x2
+#define OUTCOME_METRIC_SSIM 0x4
+#define OUTCOME_METRIC_ALL 0x7
+
+typedef enum {
+    OUTCOME_CRASH, //Nonzero exit status, or no usable output
+    OUTCOME_EXACT, //Output matches the golden output bit for bit
+    OUTCOME_TOLERABLE, //Within one of the tolerance bands
+    OUTCOME_SDC, //Silent data corruption beyond every band
+    OUTCOME_NUM
+} outcome_class_t;
+
+typedef struct {
+    approx_elem_type_t type; //Element type of the output files
+    int metrics;
+    size_t num_bands;
+    double bands[OUTCOME_MAX_BANDS]; //Ascending thresholds on the maximum relative error
+    double rel_floor; //Smallest golden magnitude used as a relative error denominator
+    double peak; //Dynamic range for PSNR and SSIM, 0 means the golden output's range
+    size_t ssim_window; //Elements per SSIM window
+    size_t threads; //Comparison threads, 0 means one per core
+} outcome_config_t;
+
+typedef struct {
+    outcome_class_t cls;
+    size_t band; //Tolerance band, for OUTCOME_TOLERABLE
+    size_t elems;
+    size_t mismatched_elems;
+    size_t nonfinite_mismatches;
+    double max_rel_err;
+    double mean_rel_err;
+    double psnr;
+    double ssim;
+} outcome_result_t;
+
+typedef struct {
+    unsigned long runs;
+    unsigned long classes[OUTCOME_NUM];
+    unsigned long groups;
+    unsigned long bytes_compared;
+    unsigned long elapsed_ticks;
+} outcome_campaign_stats_t;
+
+void outcome_config_init(outcome_config_t* config, approx_elem_type_t type);
+int outcome_compare(const outcome_config_t* config, const unsigned char* golden, size_t golden_size, const unsigned char* output, size_t output_size, outcome_result_t* result);
+long outcome_classify_campaign(const outcome_config_t* config, const char* golden_path, const char* manifest_path, const char* db_path, outcome_campaign_stats_t* stats);
+const char* outcome_class_name(outcome_class_t cls);
+void dump_outcome_result(const outcome_result_t* result);
+void dump_outcome_campaign_stats(const outcome_campaign_stats_t* stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
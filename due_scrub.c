@@ -0,0 +1,200 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_scrub.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <string.h>
+
+due_scrub_stats_t g_due_scrub_stats;
+
+static scrub_range_t g_scrub_ranges[MAX_SCRUB_RANGES];
+static size_t g_num_scrub_ranges = 0;
+static due_scrub_config_t g_scrub_config = { DUE_SCRUB_DEFAULT_BYTES_PER_KTICK, DUE_SCRUB_DEFAULT_BURST_BYTES };
+static unsigned long g_scrub_credit = 0;
+static unsigned long g_scrub_credit_millibytes = 0; //Remainder below one byte, so that frequent polls still accrue credit
+static unsigned long g_scrub_last_poll = 0;
+static unsigned long g_scrub_steps = 0;
+static scrub_range_t* g_scrub_current = NULL; //Range being read, for the trampoline handler
+
+static scrub_range_t* due_scrub_find(void** start) {
+    for (size_t i = 0; i < g_num_scrub_ranges; i++) {
+        if (g_scrub_ranges[i].start == start)
+            return g_scrub_ranges+i;
+    }
+    return NULL;
+}
+
+//Pushed around the scrub reads so that a DUE found there is attributed to the range's own handler
+static int due_scrub_handler(dueinfo_t* dueinfo) {
+    g_due_scrub_stats.dues++;
+    if (!g_scrub_current)
+        return 1;
+    g_scrub_current->dues++;
+    if (!g_scrub_current->fptr)
+        return 1;
+    return g_scrub_current->fptr(dueinfo);
+}
+
+void due_scrub_configure(const due_scrub_config_t* config) {
+    if (config)
+        g_scrub_config = *config;
+    if (g_scrub_credit > g_scrub_config.burst_bytes)
+        g_scrub_credit = g_scrub_config.burst_bytes;
+}
+
+int due_scrub_register(const char* name, void** start, void** end, user_defined_trap_handler fptr) {
+    if (!start || !end)
+        return -4;
+    scrub_range_t* r = due_scrub_find(start);
+    if (!r) {
+        if (g_num_scrub_ranges >= MAX_SCRUB_RANGES) {
+            printf("Failed to register scrub range %s, MAX_SCRUB_RANGES has been exceeded.\n", (name ? name : ""));
+            return -4;
+        }
+        r = g_scrub_ranges + g_num_scrub_ranges;
+        g_num_scrub_ranges++;
+    }
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, NAME_SIZE, "%s", (name ? name : ""));
+    r->start = start;
+    r->end = end;
+    r->fptr = fptr;
+    r->last_scrub_tick = get_sim_tick_counter();
+    if (g_due_scrub_stats.first_tick == 0)
+        g_due_scrub_stats.first_tick = r->last_scrub_tick;
+    return 0;
+}
+
+int due_scrub_unregister(void** start) {
+    scrub_range_t* r = due_scrub_find(start);
+    if (!r)
+        return -4;
+    *r = g_scrub_ranges[g_num_scrub_ranges-1];
+    g_num_scrub_ranges--;
+    return 0;
+}
+
+void due_scrub_touch(void** start) {
+    scrub_range_t* r = due_scrub_find(start);
+    if (r)
+        r->heat++;
+}
+
+//Hot ranges go first, but a cold range's priority keeps growing with the time since it was last scrubbed so that it is never starved.
+//A range whose pass already ended in this step is skipped, so a large budget never re-reads the same lines within one step.
+static scrub_range_t* due_scrub_pick(unsigned long now) {
+    scrub_range_t* best = NULL;
+    unsigned long best_score = 0;
+    for (size_t i = 0; i < g_num_scrub_ranges; i++) {
+        scrub_range_t* r = g_scrub_ranges+i;
+        if (!*(r->start) || *(r->end) <= *(r->start) || r->wrapped_step == g_scrub_steps)
+            continue;
+        unsigned long score = (r->heat+1) * (now - r->last_scrub_tick + 1);
+        if (!best || score > best_score) {
+            best = r;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+static size_t due_scrub_chunk(scrub_range_t* r, size_t budget_bytes) {
+    unsigned char* start = (unsigned char*)*(r->start);
+    size_t size = (size_t)((unsigned char*)*(r->end) - start);
+    if (r->cursor >= size) //Range shrank or moved since the last chunk
+        r->cursor = 0;
+
+    //Read the first byte of each line we own, from the cursor up to the end of the chunk
+    unsigned char* p = start + r->cursor;
+    unsigned char* limit = start + size;
+    size_t max_bytes = (budget_bytes < DUE_SCRUB_CHUNK_LINES*DUE_SCRUB_LINE_SIZE ? budget_bytes : DUE_SCRUB_CHUNK_LINES*DUE_SCRUB_LINE_SIZE);
+    if ((size_t)(limit - p) > max_bytes)
+        limit = p + max_bytes;
+
+    g_scrub_current = r;
+    push_user_memory_due_trap_handler(r->name, due_scrub_handler, &&scrub_start, &&scrub_end, STRICTNESS_STRICT);
+scrub_start:;
+    while (p < limit) {
+        (void)*(volatile unsigned char*)p;
+        p = (unsigned char*)(((unsigned long)p | (DUE_SCRUB_LINE_SIZE-1)) + 1);
+    }
+scrub_end:;
+    pop_user_memory_due_trap_handler();
+    g_scrub_current = NULL;
+
+    size_t scrubbed = (size_t)((p < limit ? p : limit) - (start + r->cursor));
+    r->cursor += scrubbed;
+    if (r->cursor >= size) {
+        r->cursor = 0;
+        r->passes++;
+        r->wrapped_step = g_scrub_steps;
+    }
+    r->bytes_scrubbed += scrubbed;
+    r->heat /= 2;
+    return scrubbed;
+}
+
+size_t due_scrub_step(size_t budget_bytes) {
+    unsigned long starttick = get_sim_tick_counter();
+    size_t total = 0;
+    g_scrub_steps++;
+    while (total < budget_bytes) {
+        scrub_range_t* r = due_scrub_pick(get_sim_tick_counter());
+        if (!r)
+            break;
+        size_t n = due_scrub_chunk(r, budget_bytes - total);
+        r->last_scrub_tick = get_sim_tick_counter();
+        g_due_scrub_stats.chunks++;
+        if (n == 0)
+            break;
+        total += n;
+    }
+    g_due_scrub_stats.bytes_scrubbed += total;
+    g_due_scrub_stats.scrub_ticks += get_sim_tick_counter() - starttick;
+    return total;
+}
+
+//Spends whatever bandwidth credit has accrued since the last poll
+size_t due_scrub_poll() {
+    unsigned long now = get_sim_tick_counter();
+    g_due_scrub_stats.polls++;
+    if (g_scrub_last_poll == 0 || now < g_scrub_last_poll) {
+        g_scrub_last_poll = now;
+        return 0;
+    }
+    unsigned long millibytes = (now - g_scrub_last_poll) * g_scrub_config.bytes_per_ktick + g_scrub_credit_millibytes;
+    g_scrub_credit += millibytes / 1000;
+    g_scrub_credit_millibytes = millibytes % 1000;
+    g_scrub_last_poll = now;
+    if (g_scrub_credit > g_scrub_config.burst_bytes)
+        g_scrub_credit = g_scrub_config.burst_bytes;
+    if (g_scrub_credit < DUE_SCRUB_LINE_SIZE)
+        return 0;
+    size_t n = due_scrub_step(g_scrub_credit);
+    g_scrub_credit = (n < g_scrub_credit ? g_scrub_credit - n : 0);
+    if (n == 0) { //Nothing registered, don't bank credit for later
+        g_scrub_credit = 0;
+        g_scrub_credit_millibytes = 0;
+    }
+    return n;
+}
+
+void dump_due_scrub_stats() {
+    unsigned long elapsed = get_sim_tick_counter() - g_due_scrub_stats.first_tick;
+    printf("Scrub polls: %lu\n", g_due_scrub_stats.polls);
+    printf("Scrub chunks: %lu\n", g_due_scrub_stats.chunks);
+    printf("Bytes scrubbed: %lu\n", g_due_scrub_stats.bytes_scrubbed);
+    printf("Ticks spent scrubbing: %lu\n", g_due_scrub_stats.scrub_ticks);
+    printf("DUEs found by scrubbing: %lu\n", g_due_scrub_stats.dues);
+    if (g_due_scrub_stats.first_tick > 0 && elapsed > 0)
+        printf("Scrub bandwidth: %f bytes per ktick\n", (double)(g_due_scrub_stats.bytes_scrubbed) * 1000 / (double)elapsed);
+    for (size_t i = 0; i < g_num_scrub_ranges; i++) {
+        scrub_range_t* r = g_scrub_ranges+i;
+        size_t size = (*(r->start) && *(r->end) > *(r->start) ? (size_t)((unsigned char*)*(r->end) - (unsigned char*)*(r->start)) : 0);
+        printf("Scrub range %s [%p, %p): %lu passes, %f%% of current pass, %lu bytes scrubbed, %lu DUEs, heat %lu\n", r->name, *(r->start), *(r->end), r->passes, (size > 0 ? (double)(r->cursor) * 100 / (double)size : 0.0), r->bytes_scrubbed, r->dues, r->heat);
+    }
+}
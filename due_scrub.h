@@ -0,0 +1,83 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Rate-limited scrubber for registered recovery regions. Latent DUEs in a registered variable are found by reading it
+ * ahead of the application, so they are handled off the critical path by the same memory_due_handler_entry() logic.
+ * The proxy kernel has no threads, so the application drives the scrubber from idle points (DUE_SCRUB_POLL) and the
+ * bandwidth budget is enforced against the tick counter.
+ */
+
+#ifndef DUE_SCRUB_H
+#define DUE_SCRUB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define MAX_SCRUB_RANGES 32
+#define DUE_SCRUB_LINE_SIZE 64 //One load per line is enough, the fill checks every word of the line
+#define DUE_SCRUB_CHUNK_LINES 64 //Lines scrubbed from one range before priorities are looked at again
+#define DUE_SCRUB_DEFAULT_BYTES_PER_KTICK 64
+#define DUE_SCRUB_DEFAULT_BURST_BYTES 16384
+
+typedef struct {
+    char name[NAME_SIZE];
+    void** start; //Points at RECOVERY_ADDR, so re-registration with EN_RECOVERY_PTR is followed
+    void** end; //Points at RECOVERY_END_ADDR
+    user_defined_trap_handler fptr; //Handler for DUEs found while scrubbing, NULL falls back to system recovery
+    size_t cursor; //Offset of the next byte to scrub in the current pass
+    unsigned long heat; //Recent accesses, decays as the range is scrubbed
+    unsigned long last_scrub_tick;
+    unsigned long bytes_scrubbed;
+    unsigned long passes; //Full sweeps of the range
+    unsigned long wrapped_step; //Last step in which a pass ended, the range gets no more chunks in that step
+    unsigned long dues;
+} scrub_range_t;
+
+typedef struct {
+    unsigned long bytes_per_ktick; //Bandwidth budget, bytes per thousand ticks
+    unsigned long burst_bytes; //Cap on credit saved up between polls
+} due_scrub_config_t;
+
+typedef struct {
+    unsigned long polls;
+    unsigned long chunks;
+    unsigned long bytes_scrubbed;
+    unsigned long scrub_ticks;
+    unsigned long dues;
+    unsigned long first_tick;
+} due_scrub_stats_t;
+
+extern due_scrub_stats_t g_due_scrub_stats;
+
+//Must come after EN_RECOVERY/EN_RECOVERY_PTR for the same variable. DUEs found by the scrubber go to DUE_RECOVERY_HANDLER(fname, seqnum).
+#define EN_SCRUB(scope, variable, fname, seqnum) \
+    due_scrub_register(STRINGIFY(VARIABLE_SCOPE_ADDR_PASTER(scope, variable)), &RECOVERY_ADDR(scope, variable), &RECOVERY_END_ADDR(scope, variable), FUNCTION_DUE_RECOVERY_NAME(fname, seqnum));
+
+#define DIS_SCRUB(scope, variable) \
+    due_scrub_unregister(&RECOVERY_ADDR(scope, variable));
+
+//Marks a range as recently used so that it is scrubbed ahead of colder ones
+#define SCRUB_TOUCH(scope, variable) \
+    due_scrub_touch(&RECOVERY_ADDR(scope, variable));
+
+#define DUE_SCRUB_POLL() \
+    due_scrub_poll();
+
+void due_scrub_configure(const due_scrub_config_t* config);
+int due_scrub_register(const char* name, void** start, void** end, user_defined_trap_handler fptr);
+int due_scrub_unregister(void** start);
+void due_scrub_touch(void** start);
+size_t due_scrub_step(size_t budget_bytes);
+size_t due_scrub_poll();
+void dump_due_scrub_stats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,270 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_trace.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+int g_due_trace_recording = 0;
+static FILE* g_due_trace_fp = NULL;
+
+//Static because we don't want these allocated on the stack in trap context
+static unsigned char g_trace_buf[DUE_TRACE_MAX_RECORD];
+
+static DUE_HANDLER_TEXT int trace_put(size_t* pos, const void* src, size_t n) {
+    if (*pos + n > DUE_TRACE_MAX_RECORD)
+        return -4;
+    memcpy(g_trace_buf + *pos, src, n);
+    *pos += n;
+    return 0;
+}
+
+static int trace_get(size_t* pos, size_t len, void* dest, size_t n) {
+    if (*pos + n > len)
+        return -4;
+    memcpy(dest, g_trace_buf + *pos, n);
+    *pos += n;
+    return 0;
+}
+
+static DUE_HANDLER_TEXT int trace_put_u8(size_t* pos, size_t v) {
+    uint8_t b = (uint8_t)v;
+    return trace_put(pos, &b, 1);
+}
+
+static int trace_get_u8(size_t* pos, size_t len, size_t* v) {
+    uint8_t b = 0;
+    int rc = trace_get(pos, len, &b, 1);
+    *v = b;
+    return rc;
+}
+
+int due_trace_open(const char* path) {
+    if (!path)
+        return -4;
+    if (g_due_trace_fp)
+        due_trace_close();
+    g_due_trace_fp = fopen(path, "wb");
+    if (!g_due_trace_fp) {
+        printf("Failed to open DUE trace %s for recording\n", path);
+        return -4;
+    }
+    uint32_t version = DUE_TRACE_VERSION;
+    uint32_t reserved = 0;
+    fwrite(DUE_TRACE_MAGIC, 1, 8, g_due_trace_fp);
+    fwrite(&version, sizeof(version), 1, g_due_trace_fp);
+    fwrite(&reserved, sizeof(reserved), 1, g_due_trace_fp);
+    fflush(g_due_trace_fp);
+    g_due_trace_recording = 1;
+    return 0;
+}
+
+void due_trace_close() {
+    g_due_trace_recording = 0;
+    if (g_due_trace_fp) {
+        fclose(g_due_trace_fp);
+        g_due_trace_fp = NULL;
+    }
+}
+
+DUE_HANDLER_TEXT void due_trace_record(trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* message_in, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type, due_handler_t* setup, int recovery_mode, word_t* message_out) {
+    if (!g_due_trace_fp || !tf || !float_tf || !candidates || !cacheline || !message_in || !setup || !message_out)
+        return;
+
+    size_t pos = 0;
+    int rc = 0;
+    size_t msg_size = message_in->size;
+    size_t name_len = strnlen(setup->name, NAME_SIZE-1);
+    int64_t vaddr = demand_vaddr;
+    uint32_t lsize = (uint32_t)load_size;
+    uint32_t ldest = (uint32_t)load_dest_reg;
+    int32_t ints[4] = { float_regfile, load_message_offset, mem_type, (int32_t)setup->strict };
+    uint64_t pcs[2] = { (uint64_t)(unsigned long)setup->pc_start, (uint64_t)(unsigned long)setup->pc_end };
+    int32_t mode = recovery_mode;
+
+    rc |= trace_put_u8(&pos, name_len);
+    rc |= trace_put(&pos, setup->name, name_len);
+    rc |= trace_put(&pos, tf, sizeof(trapframe_t));
+    rc |= trace_put(&pos, float_tf, sizeof(float_trapframe_t));
+    rc |= trace_put(&pos, &vaddr, sizeof(vaddr));
+    rc |= trace_put(&pos, &lsize, sizeof(lsize));
+    rc |= trace_put(&pos, &ldest, sizeof(ldest));
+    rc |= trace_put(&pos, ints, sizeof(ints));
+    rc |= trace_put(&pos, pcs, sizeof(pcs));
+    rc |= trace_put_u8(&pos, msg_size);
+    rc |= trace_put(&pos, message_in->bytes, msg_size);
+    rc |= trace_put_u8(&pos, candidates->size);
+    for (size_t i = 0; i < candidates->size && rc == 0; i++)
+        rc |= trace_put(&pos, candidates->candidate_messages[i].bytes, msg_size);
+    rc |= trace_put_u8(&pos, cacheline->size);
+    rc |= trace_put_u8(&pos, cacheline->blockpos);
+    for (size_t i = 0; i < cacheline->size && rc == 0; i++)
+        rc |= trace_put(&pos, cacheline->words[i].bytes, msg_size);
+    rc |= trace_put(&pos, &mode, sizeof(mode));
+    rc |= trace_put(&pos, message_out->bytes, msg_size);
+    if (rc != 0 || msg_size > MAX_WORD_SIZE || candidates->size > MAX_CANDIDATE_MSG || cacheline->size > MAX_CACHELINE_WORDS) {
+        printf("Failed to record DUE trace entry, malformed handler inputs.\n");
+        return;
+    }
+
+    //One write and flush per DUE, because the process may be killed as soon as we return an opt-to-crash recovery mode
+    uint32_t len = (uint32_t)pos;
+    fwrite(&len, sizeof(len), 1, g_due_trace_fp);
+    fwrite(g_trace_buf, 1, pos, g_due_trace_fp);
+    fflush(g_due_trace_fp);
+}
+
+//Brings the record buffer in ahead of the first DUE, see memory_due_init()
+int due_trace_prefault(int flags) {
+    return memory_due_prefault(g_trace_buf, sizeof(g_trace_buf), 1, flags);
+}
+
+long due_trace_replay(const char* path, due_replay_handler_t* handlers, size_t num_handlers) {
+    if (!path || !handlers)
+        return -4;
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Failed to open DUE trace %s for replay\n", path);
+        return -4;
+    }
+    char magic[8];
+    uint32_t header[2];
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, DUE_TRACE_MAGIC, 8) != 0 || fread(header, sizeof(uint32_t), 2, fp) != 2 || header[0] != DUE_TRACE_VERSION) {
+        printf("Failed to replay DUE trace %s, bad header\n", path);
+        fclose(fp);
+        return -4;
+    }
+
+    //Static because they are large data structures
+    static trapframe_t tf;
+    static float_trapframe_t float_tf;
+    static due_candidates_t candidates;
+    static due_cacheline_t cacheline;
+    static word_t message_in;
+    static word_t message_out;
+    static due_handler_t setup;
+    static dueinfo_t user_context;
+
+    long replayed = 0;
+    long skipped = 0;
+    due_replay_handler_t* last = NULL;
+    uint32_t len = 0;
+    while (fread(&len, sizeof(len), 1, fp) == 1) {
+        if (len > DUE_TRACE_MAX_RECORD || fread(g_trace_buf, 1, len, fp) != len) {
+            printf("Failed to replay DUE trace %s, truncated record %ld\n", path, replayed+skipped);
+            fclose(fp);
+            return -4;
+        }
+
+        size_t pos = 0;
+        int rc = 0;
+        size_t name_len = 0;
+        size_t msg_size = 0;
+        size_t num = 0;
+        int64_t vaddr = 0;
+        uint32_t lsize = 0;
+        uint32_t ldest = 0;
+        int32_t ints[4] = { 0, 0, 0, 0 };
+        uint64_t pcs[2] = { 0, 0 };
+        int32_t mode = 0;
+
+        rc |= trace_get_u8(&pos, len, &name_len);
+        if (name_len >= NAME_SIZE)
+            rc = -4;
+        rc |= trace_get(&pos, len, setup.name, (rc == 0 ? name_len : 0));
+        setup.name[(rc == 0 ? name_len : 0)] = '\0';
+        rc |= trace_get(&pos, len, &tf, sizeof(tf));
+        rc |= trace_get(&pos, len, &float_tf, sizeof(float_tf));
+        rc |= trace_get(&pos, len, &vaddr, sizeof(vaddr));
+        rc |= trace_get(&pos, len, &lsize, sizeof(lsize));
+        rc |= trace_get(&pos, len, &ldest, sizeof(ldest));
+        rc |= trace_get(&pos, len, ints, sizeof(ints));
+        rc |= trace_get(&pos, len, pcs, sizeof(pcs));
+        rc |= trace_get_u8(&pos, len, &msg_size);
+        if (msg_size > MAX_WORD_SIZE)
+            rc = -4;
+        message_in.size = msg_size;
+        message_out.size = msg_size;
+        rc |= trace_get(&pos, len, message_in.bytes, (rc == 0 ? msg_size : 0));
+        rc |= trace_get_u8(&pos, len, &num);
+        candidates.size = (num <= MAX_CANDIDATE_MSG ? num : 0);
+        for (size_t i = 0; i < candidates.size && rc == 0; i++) {
+            candidates.candidate_messages[i].size = msg_size;
+            rc |= trace_get(&pos, len, candidates.candidate_messages[i].bytes, msg_size);
+        }
+        rc |= trace_get_u8(&pos, len, &num);
+        cacheline.size = (num <= MAX_CACHELINE_WORDS ? num : 0);
+        rc |= trace_get_u8(&pos, len, &cacheline.blockpos);
+        for (size_t i = 0; i < cacheline.size && rc == 0; i++) {
+            cacheline.words[i].size = msg_size;
+            rc |= trace_get(&pos, len, cacheline.words[i].bytes, msg_size);
+        }
+        rc |= trace_get(&pos, len, &mode, sizeof(mode));
+        rc |= trace_get(&pos, len, message_out.bytes, (rc == 0 ? msg_size : 0));
+        if (rc != 0) {
+            printf("Failed to replay DUE trace %s, malformed record %ld\n", path, replayed+skipped);
+            fclose(fp);
+            return -4;
+        }
+
+        //Traces are usually dominated by a few handlers, so check the last match first
+        due_replay_handler_t* h = NULL;
+        if (last && strcmp(last->name, setup.name) == 0)
+            h = last;
+        for (size_t i = 0; !h && i < num_handlers; i++) {
+            if (handlers[i].name && handlers[i].fptr && strcmp(handlers[i].name, setup.name) == 0)
+                h = handlers+i;
+        }
+        if (!h) {
+            skipped++;
+            continue;
+        }
+        last = h;
+
+        setup.fptr = h->fptr;
+        setup.strict = (due_region_strictness_t)ints[3];
+        setup.pc_start = (void*)(unsigned long)pcs[0];
+        setup.pc_end = (void*)(unsigned long)pcs[1];
+        setup.restart = 0;
+        setup.invocations = 0;
+        if (!init_dueinfo(&user_context, &tf, &float_tf, (long)vaddr, &candidates, &cacheline, &message_in, lsize, ldest, ints[0], ints[1], ints[2], &setup, 0)) {
+            skipped++;
+            continue;
+        }
+
+        //Same bounds check as memory_due_handler_entry(), so that out-of-bounds DUEs replay as such
+        unsigned long starttick = get_sim_tick_counter();
+        void* epc = (void*)(user_context.tf.epc);
+        if (setup.strict != STRICTNESS_DEFAULT && (epc < setup.pc_start || epc >= setup.pc_end))
+            user_context.recovery_mode = -3;
+        else
+            user_context.recovery_mode = h->fptr(&user_context);
+        h->ticks += get_sim_tick_counter() - starttick;
+        h->replayed++;
+        if (user_context.recovery_mode != mode)
+            h->mode_mismatches++;
+        if (user_context.recovered_message.size != msg_size || memcmp(user_context.recovered_message.bytes, message_out.bytes, msg_size) != 0)
+            h->message_mismatches++;
+        replayed++;
+    }
+
+    if (skipped > 0)
+        printf("Skipped %ld DUE trace records with no matching handler\n", skipped);
+    fclose(fp);
+    return replayed;
+}
+
+void dump_replay_stats(due_replay_handler_t* handlers, size_t num_handlers) {
+    for (size_t i = 0; i < num_handlers; i++) {
+        due_replay_handler_t* h = handlers+i;
+        printf("Handler %s: %lu replayed, %lu recovery mode mismatches, %lu recovered message mismatches", h->name, h->replayed, h->mode_mismatches, h->message_mismatches);
+        if (h->replayed > 0)
+            printf(", %f ticks per DUE", (double)(h->ticks) / (double)(h->replayed));
+        printf("\n");
+    }
+}
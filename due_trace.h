@@ -0,0 +1,59 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Record-and-replay of the complete handler inputs and outputs for every DUE delivered to memory_due_handler_entry().
+ *
+ * Trace format (native byte order and word size, so replay on the same ABI that recorded it):
+ *   File header: 8-byte magic DUE_TRACE_MAGIC, uint32 version, uint32 reserved
+ *   Per DUE: uint32 payload length, then the payload:
+ *     uint8 name length, handler name bytes
+ *     trapframe_t, float_trapframe_t
+ *     int64 demand_vaddr, uint32 load_size, uint32 load_dest_reg, int32 float_regfile, int32 load_message_offset, int32 mem_type
+ *     int32 strict, uint64 pc_start, uint64 pc_end
+ *     uint8 message size, message bytes as delivered by the OS
+ *     uint8 number of candidates, candidate bytes (message size each)
+ *     uint8 cacheline words, uint8 blockpos, word bytes (message size each)
+ *     int32 recovery mode chosen, recovered message bytes (message size)
+ *
+ * DUEs that the entry could not hand to a handler are recorded too, with the mode it returned. Those with no region and no pushed
+ * handler at all have an empty name and zero PCs, so replay skips them.
+ */
+
+#ifndef DUE_TRACE_H
+#define DUE_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define DUE_TRACE_MAGIC "SDECCTRC"
+#define DUE_TRACE_VERSION 1
+#define DUE_TRACE_MAX_RECORD 8192
+
+typedef struct {
+    const char* name; //Handler name as recorded, i.e., STRINGIFY(FUNCTION_DUE_RECOVERY_NAME(fname, seqnum))
+    user_defined_trap_handler fptr;
+    unsigned long replayed;
+    unsigned long mode_mismatches;
+    unsigned long message_mismatches;
+    unsigned long ticks;
+} due_replay_handler_t;
+
+extern int g_due_trace_recording;
+
+int due_trace_open(const char* path);
+void due_trace_close();
+int due_trace_prefault(int flags);
+void due_trace_record(trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* message_in, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type, due_handler_t* setup, int recovery_mode, word_t* message_out);
+long due_trace_replay(const char* path, due_replay_handler_t* handlers, size_t num_handlers);
+void dump_replay_stats(due_replay_handler_t* handlers, size_t num_handlers);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
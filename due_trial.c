@@ -0,0 +1,189 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "due_trial.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+due_trial_stats_t g_due_trial_stats;
+
+#if defined(__linux__)
+typedef struct {
+    pid_t pid;
+    int fd;
+    int done;
+    int rc;
+    unsigned long digest;
+} due_trial_t;
+
+typedef struct {
+    int rc;
+    unsigned long digest;
+} due_trial_result_t;
+
+static unsigned long due_trial_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)ts.tv_nsec / 1000UL;
+}
+
+static int due_trial_launch(due_trial_t* t, dueinfo_t* dueinfo, size_t c, due_trial_fn trial, void* arg) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -4;
+    fflush(stdout); //Don't let the child replay buffered output
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -4;
+    }
+    if (pid == 0) {
+        //Child: put the candidate in place of the victim message in our private copy of memory, then re-run the region
+        close(fds[0]);
+        word_t* cand = dueinfo->candidates.candidate_messages+c;
+        unsigned long msg_addr = (unsigned long)(dueinfo->tf.badvaddr) - (unsigned long)(dueinfo->tf.badvaddr) % cand->size;
+        memcpy((void*)msg_addr, cand->bytes, cand->size);
+        copy_word(&(dueinfo->recovered_message), cand);
+        due_trial_result_t result;
+        result.digest = 0;
+        result.rc = trial(dueinfo, arg, &result.digest);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    t->pid = pid;
+    t->fd = fds[0];
+    t->done = 0;
+    t->rc = -1;
+    t->digest = 0;
+    return 0;
+}
+
+static void due_trial_reap(due_trial_t* t, int kill_it) {
+    if (kill_it)
+        kill(t->pid, SIGKILL);
+    waitpid(t->pid, NULL, 0);
+    close(t->fd);
+    t->done = 1;
+}
+#endif
+
+int due_trial_select(dueinfo_t* dueinfo, due_trial_fn trial, void* arg, const due_trial_config_t* config) {
+    if (!dueinfo || !dueinfo->valid || !trial || dueinfo->candidates.size == 0)
+        return -4;
+#if defined(__linux__)
+    static due_trial_t trials[MAX_CANDIDATE_MSG];
+    size_t num = dueinfo->candidates.size;
+    size_t max_parallel = (config ? config->max_parallel : 0);
+    unsigned long budget_us = (config && config->budget_us > 0 ? config->budget_us : DUE_TRIAL_DEFAULT_BUDGET_US);
+    int require_agreement = (config ? config->require_agreement : 1);
+    if (max_parallel == 0) { //Leave the core we are running on alone
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        max_parallel = (cores > 1 ? (size_t)(cores-1) : 1);
+    }
+
+    g_due_trial_stats.selections++;
+    unsigned long deadline = due_trial_now_us() + budget_us;
+    size_t next = 0;
+    size_t running = 0;
+    size_t finished = 0;
+    while (finished < num) {
+        //Keep up to max_parallel trials in flight
+        while (next < num && running < max_parallel) {
+            if (due_trial_launch(trials+next, dueinfo, next, trial, arg) != 0) {
+                trials[next].done = 1;
+                trials[next].rc = -1;
+                finished++;
+            } else {
+                g_due_trial_stats.trials++;
+                running++;
+            }
+            next++;
+        }
+        if (running == 0)
+            continue;
+
+        unsigned long now = due_trial_now_us();
+        if (now >= deadline)
+            break;
+        struct pollfd pfds[MAX_CANDIDATE_MSG];
+        size_t idx[MAX_CANDIDATE_MSG];
+        size_t npfds = 0;
+        for (size_t i = 0; i < next; i++) {
+            if (!trials[i].done) {
+                pfds[npfds].fd = trials[i].fd;
+                pfds[npfds].events = POLLIN;
+                pfds[npfds].revents = 0;
+                idx[npfds] = i;
+                npfds++;
+            }
+        }
+        unsigned long wait_ms = (deadline - now + 999) / 1000;
+        if (poll(pfds, npfds, (int)wait_ms) < 0)
+            break;
+        for (size_t p = 0; p < npfds; p++) {
+            if (pfds[p].revents == 0)
+                continue;
+            due_trial_t* t = trials + idx[p];
+            due_trial_result_t result;
+            if (read(t->fd, &result, sizeof(result)) == sizeof(result)) {
+                t->rc = result.rc;
+                t->digest = result.digest;
+            } //Otherwise the trial crashed, which counts as inconsistent
+            due_trial_reap(t, 0);
+            running--;
+            finished++;
+        }
+    }
+
+    //Out of time: whatever is still running is inconsistent as far as we are concerned
+    for (size_t i = 0; i < next; i++) {
+        if (!trials[i].done) {
+            due_trial_reap(trials+i, 1);
+            g_due_trial_stats.timeouts++;
+        }
+    }
+
+    //Commit the lowest-index consistent candidate, unless consistent trials disagree on their outputs
+    long chosen = -1;
+    for (size_t i = 0; i < next; i++) {
+        if (trials[i].rc != 0)
+            continue;
+        g_due_trial_stats.consistent++;
+        if (chosen < 0)
+            chosen = (long)i;
+        else if (require_agreement && trials[i].digest != trials[chosen].digest) {
+            g_due_trial_stats.ambiguous++;
+            return -1;
+        }
+    }
+    if (chosen < 0)
+        return -1;
+    copy_word(&(dueinfo->recovered_message), dueinfo->candidates.candidate_messages+chosen);
+    return (int)chosen;
+#else
+    printf("Forked candidate trials are not supported on this platform.\n");
+    return -4;
+#endif
+}
+
+void dump_due_trial_stats() {
+    printf("Candidate trial selections: %lu\n", g_due_trial_stats.selections);
+    printf("Candidate trials run: %lu\n", g_due_trial_stats.trials);
+    printf("Consistent trials: %lu\n", g_due_trial_stats.consistent);
+    printf("Timed out trials: %lu\n", g_due_trial_stats.timeouts);
+    printf("Ambiguous selections: %lu\n", g_due_trial_stats.ambiguous);
+}
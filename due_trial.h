@@ -0,0 +1,50 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Speculative candidate evaluation through forked trial executions, for when no cheap legality predicate exists.
+ * Each surviving candidate is written into a forked copy of the process, which runs the region's computation and checks
+ * its invariants. The candidate whose trial ends in a consistent state is committed. Only available on host Linux builds;
+ * the proxy kernel has no fork().
+ */
+
+#ifndef DUE_TRIAL_H
+#define DUE_TRIAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+//Re-executes the body of the enclosing DUE region with the candidate already in memory. Returns 0 if the result is consistent,
+//and may summarize its outputs in *digest so that trials can be compared with each other.
+typedef int (*due_trial_fn)(dueinfo_t* dueinfo, void* arg, unsigned long* digest);
+
+typedef struct {
+    size_t max_parallel; //Cap on concurrent trials, 0 means one per idle core
+    unsigned long budget_us; //Wall-clock budget for all trials together
+    int require_agreement; //If several trials are consistent, they must produce the same digest
+} due_trial_config_t;
+
+typedef struct {
+    unsigned long selections;
+    unsigned long trials;
+    unsigned long consistent;
+    unsigned long timeouts;
+    unsigned long ambiguous;
+} due_trial_stats_t;
+
+#define DUE_TRIAL_DEFAULT_BUDGET_US 100000
+
+extern due_trial_stats_t g_due_trial_stats;
+
+int due_trial_select(dueinfo_t* dueinfo, due_trial_fn trial, void* arg, const due_trial_config_t* config);
+void dump_due_trial_stats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
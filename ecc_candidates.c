@@ -0,0 +1,369 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "ecc_candidates.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <string.h>
+
+//Enumeration state. Static because we don't want this allocated on the stack, and enumeration is not re-entrant anyway.
+static const ecc_code_t* g_ecc_code;
+static unsigned long g_ecc_received[ECC_CODEWORD_WORDS];
+static const ecc_pattern_t* g_ecc_chosen[ECC_MAX_WEIGHT];
+static due_candidates_t* g_ecc_candidates;
+static size_t g_ecc_total;
+
+static int ecc_parity(unsigned long x) {
+    return __builtin_parityl(x);
+}
+
+static void ecc_bytes_to_words(const unsigned char* bytes, size_t nbits, unsigned long* words) {
+    for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++)
+        words[w] = 0;
+    for (size_t b = 0; b < (nbits+7)/8; b++)
+        words[b/8] |= (unsigned long)bytes[b] << ((b%8)*8);
+    if (nbits % 64 != 0) //Ignore any padding bits past the end of the codeword
+        words[nbits/64] &= (1UL << (nbits%64)) - 1;
+}
+
+static void ecc_words_to_bytes(const unsigned long* words, size_t nbits, unsigned char* bytes) {
+    for (size_t b = 0; b < (nbits+7)/8; b++)
+        bytes[b] = (unsigned char)(words[b/8] >> ((b%8)*8));
+}
+
+static size_t ecc_syndrome_hash(unsigned long syn) {
+    return (size_t)((syn * 0x9E3779B97F4A7C15UL) >> 32) & (ECC_SYNDROME_HASH_SIZE-1);
+}
+
+//Row-reduces H so that the parity positions k..n-1 form an identity, which makes encoding and message extraction trivial.
+//Row operations do not change the code. Column swaps do (they reorder codeword bits), so they are only allowed for our own presets.
+static int ecc_finalize(ecc_code_t* code, int allow_swaps) {
+    size_t n = code->n;
+    size_t k = code->k;
+    size_t r = code->r;
+
+    memset(code->rows, 0, sizeof(code->rows));
+    for (size_t j = 0; j < n; j++) {
+        for (size_t i = 0; i < r; i++) {
+            if ((code->columns[j] >> i) & 1)
+                code->rows[i][j/64] |= 1UL << (j%64);
+        }
+    }
+
+    for (size_t p = 0; p < r; p++) {
+        size_t c = k+p;
+        size_t piv = r;
+        for (size_t i = p; i < r && piv == r; i++) {
+            if ((code->rows[i][c/64] >> (c%64)) & 1)
+                piv = i;
+        }
+        if (piv == r && allow_swaps) { //Bring in a data column that still has a pivot available
+            for (size_t c2 = 0; c2 < k && piv == r; c2++) {
+                for (size_t i = p; i < r && piv == r; i++) {
+                    if ((code->rows[i][c2/64] >> (c2%64)) & 1) {
+                        piv = i;
+                        for (size_t row = 0; row < r; row++) {
+                            unsigned long b1 = (code->rows[row][c/64] >> (c%64)) & 1;
+                            unsigned long b2 = (code->rows[row][c2/64] >> (c2%64)) & 1;
+                            if (b1 != b2) {
+                                code->rows[row][c/64] ^= 1UL << (c%64);
+                                code->rows[row][c2/64] ^= 1UL << (c2%64);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        if (piv == r) {
+            printf("Failed to set up ECC code %s, parity-check matrix is singular in the parity positions.\n", code->name);
+            return -4;
+        }
+        for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++) {
+            unsigned long tmp = code->rows[p][w];
+            code->rows[p][w] = code->rows[piv][w];
+            code->rows[piv][w] = tmp;
+        }
+        for (size_t i = 0; i < r; i++) {
+            if (i != p && ((code->rows[i][c/64] >> (c%64)) & 1)) {
+                for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++)
+                    code->rows[i][w] ^= code->rows[p][w];
+            }
+        }
+    }
+
+    for (size_t j = 0; j < n; j++) {
+        code->columns[j] = 0;
+        for (size_t i = 0; i < r; i++)
+            code->columns[j] |= ((code->rows[i][j/64] >> (j%64)) & 1) << i;
+    }
+
+    //Syndrome of every nonzero error pattern within a single symbol
+    size_t b = code->symbol_bits;
+    size_t num_symbols = n / b;
+    size_t num_patterns = (1UL << b) - 1;
+    if (num_symbols * num_patterns > ECC_MAX_PATTERNS) {
+        printf("Failed to set up ECC code %s, ECC_MAX_PATTERNS has been exceeded.\n", code->name);
+        return -4;
+    }
+    code->num_patterns = 0;
+    for (size_t s = 0; s < num_symbols; s++) {
+        for (size_t pat = 1; pat <= num_patterns; pat++) {
+            unsigned long syn = 0;
+            for (size_t bit = 0; bit < b; bit++) {
+                if ((pat >> bit) & 1)
+                    syn ^= code->columns[s*b+bit];
+            }
+            code->patterns[code->num_patterns].syndrome = syn;
+            code->patterns[code->num_patterns].symbol = (unsigned short)s;
+            code->patterns[code->num_patterns].pattern = (unsigned short)pat;
+            code->num_patterns++;
+        }
+    }
+
+    //Chain in reverse so each hash chain lists patterns in increasing symbol order
+    for (size_t h = 0; h < ECC_SYNDROME_HASH_SIZE; h++)
+        code->syndrome_heads[h] = ECC_NO_PATTERN;
+    for (size_t i = code->num_patterns; i-- > 0;) {
+        size_t h = ecc_syndrome_hash(code->patterns[i].syndrome);
+        code->syndrome_next[i] = code->syndrome_heads[h];
+        code->syndrome_heads[h] = (unsigned short)i;
+    }
+    return 0;
+}
+
+static int ecc_check_params(size_t n, size_t k, size_t symbol_bits, size_t max_weight) {
+    if (n > ECC_MAX_CODEWORD_BITS || k >= n || n-k > ECC_MAX_PARITY_BITS || k % 8 != 0 || k/8 > MAX_WORD_SIZE)
+        return -4;
+    if (symbol_bits < 1 || symbol_bits > ECC_MAX_SYMBOL_BITS || n % symbol_bits != 0 || max_weight < 1 || max_weight > ECC_MAX_WEIGHT)
+        return -4;
+    return 0;
+}
+
+static void ecc_set_params(ecc_code_t* code, const char* name, size_t n, size_t k, size_t symbol_bits, size_t max_weight) {
+    snprintf(code->name, NAME_SIZE, "%s", name);
+    code->n = n;
+    code->k = k;
+    code->r = n-k;
+    code->symbol_bits = symbol_bits;
+    code->max_weight = max_weight;
+}
+
+//Multiplication in GF(2^m) with the given primitive polynomial
+static unsigned gf_mul(unsigned a, unsigned b, unsigned poly, unsigned m) {
+    unsigned result = 0;
+    while (b) {
+        if (b & 1)
+            result ^= a;
+        b >>= 1;
+        a <<= 1;
+        if (a & (1U << m))
+            a ^= poly;
+    }
+    return result;
+}
+
+int ecc_init_preset(ecc_code_t* code, ecc_preset_t preset) {
+    if (!code)
+        return -4;
+
+    switch (preset) {
+        case ECC_PRESET_SECDED_72_64: {
+            //Hsiao: all 56 weight-3 columns and 8 weight-5 columns for data, unit columns for parity
+            ecc_set_params(code, "SECDED (72,64) Hsiao", 72, 64, 1, 2);
+            size_t j = 0;
+            for (unsigned long v = 0; v < 256 && j < 56; v++) {
+                if (__builtin_popcountl(v) == 3)
+                    code->columns[j++] = v;
+            }
+            for (unsigned long v = 0; v < 256 && j < 64; v++) {
+                if (__builtin_popcountl(v) == 5)
+                    code->columns[j++] = v;
+            }
+            for (size_t p = 0; p < 8; p++)
+                code->columns[64+p] = 1UL << p;
+            return ecc_finalize(code, 0);
+        }
+        case ECC_PRESET_DECTED_79_64: {
+            //Shortened binary BCH over GF(2^7), x^7+x^3+1, with rows for alpha^i, alpha^3i, and overall parity
+            ecc_set_params(code, "DECTED (79,64) BCH", 79, 64, 1, 3);
+            unsigned a1 = 1;
+            unsigned a3 = 1;
+            unsigned alpha3 = gf_mul(gf_mul(2, 2, 0x89, 7), 2, 0x89, 7);
+            for (size_t j = 0; j < 79; j++) {
+                code->columns[j] = (unsigned long)a1 | ((unsigned long)a3 << 7) | (1UL << 14);
+                a1 = gf_mul(a1, 2, 0x89, 7);
+                a3 = gf_mul(a3, alpha3, 0x89, 7);
+            }
+            return ecc_finalize(code, 1);
+        }
+        case ECC_PRESET_CHIPKILL_152_128: {
+            //Reed-Solomon over GF(2^8), x^8+x^4+x^3+x^2+1, 16 data + 3 check x8 symbols: any 3 columns are Vandermonde, so distance 4
+            ecc_set_params(code, "ChipKill-style SSC-DSD (152,128)", 152, 128, 8, 2);
+            unsigned x = 1;
+            for (size_t s = 0; s < 19; s++) {
+                unsigned x2 = gf_mul(x, x, 0x11d, 8);
+                for (size_t bit = 0; bit < 8; bit++) {
+                    unsigned e = 1U << bit;
+                    code->columns[s*8+bit] = (unsigned long)e | ((unsigned long)gf_mul(e, x, 0x11d, 8) << 8) | ((unsigned long)gf_mul(e, x2, 0x11d, 8) << 16);
+                }
+                x = gf_mul(x, 2, 0x11d, 8);
+            }
+            return ecc_finalize(code, 0);
+        }
+        default:
+            return -4;
+    }
+}
+
+int ecc_init_custom(ecc_code_t* code, const char* name, size_t n, size_t k, size_t symbol_bits, size_t max_weight, const unsigned long* columns) {
+    if (!code || !name || !columns || ecc_check_params(n, k, symbol_bits, max_weight) != 0)
+        return -4;
+    ecc_set_params(code, name, n, k, symbol_bits, max_weight);
+    for (size_t j = 0; j < n; j++)
+        code->columns[j] = columns[j] & (code->r == 64 ? ~0UL : (1UL << code->r) - 1);
+    return ecc_finalize(code, 0);
+}
+
+int ecc_encode(const ecc_code_t* code, const word_t* message, unsigned char* codeword) {
+    if (!code || !message || !codeword || message->size*8 != code->k)
+        return -4;
+    unsigned long words[ECC_CODEWORD_WORDS];
+    ecc_bytes_to_words(message->bytes, code->k, words);
+    for (size_t p = 0; p < code->r; p++) { //Row p only touches parity position k+p, which is still zero
+        unsigned long acc = 0;
+        for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++)
+            acc ^= words[w] & code->rows[p][w];
+        size_t c = code->k+p;
+        words[c/64] |= (unsigned long)ecc_parity(acc) << (c%64);
+    }
+    ecc_words_to_bytes(words, code->n, codeword);
+    return 0;
+}
+
+static unsigned long ecc_syndrome_words(const ecc_code_t* code, const unsigned long* words) {
+    unsigned long syn = 0;
+    for (size_t i = 0; i < code->r; i++) {
+        unsigned long acc = 0;
+        for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++)
+            acc ^= words[w] & code->rows[i][w];
+        syn |= (unsigned long)ecc_parity(acc) << i;
+    }
+    return syn;
+}
+
+unsigned long ecc_syndrome(const ecc_code_t* code, const unsigned char* codeword) {
+    unsigned long words[ECC_CODEWORD_WORDS];
+    ecc_bytes_to_words(codeword, code->n, words);
+    return ecc_syndrome_words(code, words);
+}
+
+//Bit-sliced syndromes for many codewords (e.g., a whole cacheline) packed back to back: 64 codewords are transposed so
+//that each codeword bit position becomes one 64-lane word, and each syndrome bit is then an XOR of those lane words.
+void ecc_syndromes_bitsliced(const ecc_code_t* code, const unsigned char* codewords, size_t count, unsigned long* syndromes) {
+    static unsigned long lanes[ECC_MAX_CODEWORD_BITS];
+    size_t nbytes = (code->n+7)/8;
+    for (size_t base = 0; base < count; base += 64) {
+        size_t batch = (count-base < 64 ? count-base : 64);
+        memset(lanes, 0, code->n * sizeof(unsigned long));
+        for (size_t t = 0; t < batch; t++) {
+            const unsigned char* cw = codewords + (base+t)*nbytes;
+            for (size_t b = 0; b < nbytes; b++) {
+                unsigned v = cw[b];
+                while (v) {
+                    size_t j = b*8 + __builtin_ctz(v);
+                    if (j < code->n)
+                        lanes[j] |= 1UL << t;
+                    v &= v-1;
+                }
+            }
+            syndromes[base+t] = 0;
+        }
+        for (size_t i = 0; i < code->r; i++) {
+            unsigned long acc = 0;
+            for (size_t w = 0; w < ECC_CODEWORD_WORDS; w++) {
+                unsigned long m = code->rows[i][w];
+                while (m) {
+                    acc ^= lanes[w*64 + __builtin_ctzl(m)];
+                    m &= m-1;
+                }
+            }
+            while (acc) {
+                syndromes[base + __builtin_ctzl(acc)] |= 1UL << i;
+                acc &= acc-1;
+            }
+        }
+    }
+}
+
+static void ecc_add_candidate(size_t weight) {
+    g_ecc_total++;
+    if (g_ecc_candidates->size >= MAX_CANDIDATE_MSG)
+        return;
+    unsigned long words[ECC_CODEWORD_WORDS];
+    memcpy(words, g_ecc_received, sizeof(words));
+    size_t b = g_ecc_code->symbol_bits;
+    for (size_t e = 0; e < weight; e++) {
+        for (size_t bit = 0; bit < b; bit++) {
+            if ((g_ecc_chosen[e]->pattern >> bit) & 1) {
+                size_t j = g_ecc_chosen[e]->symbol*b + bit;
+                words[j/64] ^= 1UL << (j%64);
+            }
+        }
+    }
+    word_t* cand = g_ecc_candidates->candidate_messages + g_ecc_candidates->size;
+    ecc_words_to_bytes(words, g_ecc_code->k, cand->bytes);
+    cand->size = g_ecc_code->k/8;
+    g_ecc_candidates->size++;
+}
+
+//Chooses error symbols in increasing order, so each error pattern is visited once. The last one is looked up by its syndrome.
+static void ecc_search(size_t depth, size_t weight, unsigned long target, long prev_symbol) {
+    const ecc_pattern_t* pats = g_ecc_code->patterns;
+    if (depth == weight-1) {
+        for (size_t i = g_ecc_code->syndrome_heads[ecc_syndrome_hash(target)]; i != ECC_NO_PATTERN; i = g_ecc_code->syndrome_next[i]) {
+            if (pats[i].syndrome == target && (long)pats[i].symbol > prev_symbol) {
+                g_ecc_chosen[depth] = pats+i;
+                ecc_add_candidate(weight);
+            }
+        }
+        return;
+    }
+    size_t per_symbol = (1UL << g_ecc_code->symbol_bits) - 1;
+    for (size_t i = (size_t)(prev_symbol+1) * per_symbol; i < g_ecc_code->num_patterns; i++) {
+        g_ecc_chosen[depth] = pats+i;
+        ecc_search(depth+1, weight, target ^ pats[i].syndrome, pats[i].symbol);
+    }
+}
+
+int ecc_enumerate_candidates(const ecc_code_t* code, const unsigned char* received, due_candidates_t* candidates, size_t* total) {
+    if (!code || !received || !candidates)
+        return -4;
+    g_ecc_code = code;
+    g_ecc_candidates = candidates;
+    g_ecc_total = 0;
+    candidates->size = 0;
+    ecc_bytes_to_words(received, code->n, g_ecc_received);
+
+    unsigned long syn = ecc_syndrome_words(code, g_ecc_received);
+    if (syn == 0) { //Valid codeword, the only candidate is the received message
+        ecc_add_candidate(0);
+    } else {
+        //All candidates at the minimum distance from the received codeword
+        for (size_t weight = 1; weight <= code->max_weight && g_ecc_total == 0; weight++)
+            ecc_search(0, weight, syn, -1);
+    }
+
+    if (total)
+        *total = g_ecc_total;
+    return (g_ecc_total > 0 ? 0 : -1);
+}
+
+void dump_ecc_code(const ecc_code_t* code) {
+    printf("ECC code: %s\n", code->name);
+    printf("Codeword bits: %lu, message bits: %lu, parity bits: %lu\n", code->n, code->k, code->r);
+    printf("Symbol bits: %lu, max symbol errors enumerated: %lu\n", code->symbol_bits, code->max_weight);
+    printf("Single-symbol error patterns: %lu\n", code->num_patterns);
+}
@@ -0,0 +1,72 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Userspace ECC candidate enumerator. Given a received codeword and a parity-check matrix, computes the syndrome and
+ * enumerates every equidistant candidate message into a due_candidates_t, just like the modified proxy kernel does.
+ * This lets handler logic be tested and tuned, and candidate counts be studied offline, without the kernel.
+ *
+ * Codewords are stored as bytes with bit j in byte j/8, bit j%8. The first k bits are the message (the memory bytes),
+ * the remaining r = n-k bits are parity. Symbol codes (ChipKill-style) group consecutive symbol_bits bits per symbol.
+ */
+
+#ifndef ECC_CANDIDATES_H
+#define ECC_CANDIDATES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define ECC_MAX_CODEWORD_BITS (MAX_WORD_SIZE*8+64)
+#define ECC_MAX_PARITY_BITS 64
+#define ECC_CODEWORD_WORDS ((ECC_MAX_CODEWORD_BITS+63)/64)
+#define ECC_MAX_SYMBOL_BITS 8
+#define ECC_MAX_PATTERNS 5120 //Enough for 20 x8 symbols or 80 x4 symbols
+#define ECC_MAX_WEIGHT 3
+#define ECC_SYNDROME_HASH_SIZE 8192 //Must be a power of two
+#define ECC_NO_PATTERN 0xffff
+
+typedef enum {
+    ECC_PRESET_SECDED_72_64, //Hsiao SEC-DED
+    ECC_PRESET_DECTED_79_64, //Extended binary BCH DEC-TED
+    ECC_PRESET_CHIPKILL_152_128, //Reed-Solomon SSC-DSD over GF(2^8), x8 symbols
+    ECC_PRESET_NUM
+} ecc_preset_t;
+
+typedef struct {
+    unsigned long syndrome;
+    unsigned short symbol;
+    unsigned short pattern;
+} ecc_pattern_t;
+
+typedef struct {
+    char name[NAME_SIZE];
+    size_t n;
+    size_t k;
+    size_t r;
+    size_t symbol_bits;
+    size_t max_weight; //Largest number of symbol errors enumerated
+    unsigned long columns[ECC_MAX_CODEWORD_BITS]; //Column j of H as an r-bit syndrome
+    unsigned long rows[ECC_MAX_PARITY_BITS][ECC_CODEWORD_WORDS]; //Row i of H as an n-bit mask
+    ecc_pattern_t patterns[ECC_MAX_PATTERNS]; //Syndrome of every single-symbol error, in symbol-major order
+    size_t num_patterns;
+    unsigned short syndrome_heads[ECC_SYNDROME_HASH_SIZE]; //Hash chains over patterns by syndrome, ECC_NO_PATTERN terminated
+    unsigned short syndrome_next[ECC_MAX_PATTERNS];
+} ecc_code_t;
+
+int ecc_init_preset(ecc_code_t* code, ecc_preset_t preset);
+int ecc_init_custom(ecc_code_t* code, const char* name, size_t n, size_t k, size_t symbol_bits, size_t max_weight, const unsigned long* columns);
+int ecc_encode(const ecc_code_t* code, const word_t* message, unsigned char* codeword);
+unsigned long ecc_syndrome(const ecc_code_t* code, const unsigned char* codeword);
+void ecc_syndromes_bitsliced(const ecc_code_t* code, const unsigned char* codewords, size_t count, unsigned long* syndromes);
+int ecc_enumerate_candidates(const ecc_code_t* code, const unsigned char* received, due_candidates_t* candidates, size_t* total);
+void dump_ecc_code(const ecc_code_t* code);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
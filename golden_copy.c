@@ -0,0 +1,323 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE //For dl_iterate_phdr()
+#endif
+#include "golden_copy.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//Originally defined in elf.h, which is not available with every toolchain we build with
+typedef struct {
+    unsigned char e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint64_t e_entry;
+    uint64_t e_phoff;
+    uint64_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} golden_elf64_ehdr_t;
+
+//Originally defined in elf.h
+typedef struct {
+    uint32_t sh_name;
+    uint32_t sh_type;
+    uint64_t sh_flags;
+    uint64_t sh_addr;
+    uint64_t sh_offset;
+    uint64_t sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    uint64_t sh_addralign;
+    uint64_t sh_entsize;
+} golden_elf64_shdr_t;
+
+#define GOLDEN_ELFCLASS64 2
+#define GOLDEN_SHT_PROGBITS 1
+#define GOLDEN_SHF_WRITE 0x1
+#define GOLDEN_SHF_ALLOC 0x2
+
+static golden_image_t g_golden_images[MAX_GOLDEN_IMAGES];
+static int g_golden_num_images = 0;
+static golden_segment_t g_golden_segments[MAX_GOLDEN_SEGMENTS];
+static int g_golden_num_segments = 0;
+
+//Open-addressed index from 64 KB address chunk to the lowest segment overlapping it
+static unsigned long g_golden_index_keys[GOLDEN_INDEX_SIZE];
+static int g_golden_index_segs[GOLDEN_INDEX_SIZE];
+static int g_golden_index_valid = 0;
+
+static int golden_read(int fd, unsigned long offset, void* dest, size_t size) {
+    if (lseek(fd, (off_t)offset, SEEK_SET) != (off_t)offset)
+        return -4;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, (unsigned char*)dest + done, size - done);
+        if (got <= 0)
+            return -4;
+        done += (size_t)got;
+    }
+    return 0;
+}
+
+static DUE_HANDLER_TEXT size_t golden_index_slot(unsigned long chunk) {
+    return (size_t)((chunk * 0x9E3779B97F4A7C15UL) >> 32) & (GOLDEN_INDEX_SIZE-1);
+}
+
+static void golden_build_index() {
+    //Sort segments by start address (there are few of them, and this only runs at startup)
+    for (int i = 1; i < g_golden_num_segments; i++) {
+        golden_segment_t tmp = g_golden_segments[i];
+        int j = i-1;
+        while (j >= 0 && g_golden_segments[j].vaddr_start > tmp.vaddr_start) {
+            g_golden_segments[j+1] = g_golden_segments[j];
+            j--;
+        }
+        g_golden_segments[j+1] = tmp;
+    }
+
+    for (size_t i = 0; i < GOLDEN_INDEX_SIZE; i++)
+        g_golden_index_segs[i] = -1;
+    g_golden_index_valid = 1;
+    size_t used = 0;
+    for (int s = 0; s < g_golden_num_segments; s++) {
+        unsigned long first = g_golden_segments[s].vaddr_start >> GOLDEN_CHUNK_SHIFT;
+        unsigned long last = (g_golden_segments[s].vaddr_end-1) >> GOLDEN_CHUNK_SHIFT;
+        for (unsigned long chunk = first; chunk <= last; chunk++) {
+            size_t slot = golden_index_slot(chunk);
+            while (g_golden_index_segs[slot] >= 0 && g_golden_index_keys[slot] != chunk)
+                slot = (slot+1) & (GOLDEN_INDEX_SIZE-1);
+            if (g_golden_index_segs[slot] >= 0) //Chunk already owned by a lower segment
+                continue;
+            if (used+1 > GOLDEN_INDEX_SIZE*3/4) { //Too sparse to index compactly, fall back to scanning the segment table
+                g_golden_index_valid = 0;
+                return;
+            }
+            g_golden_index_keys[slot] = chunk;
+            g_golden_index_segs[slot] = s;
+            used++;
+        }
+    }
+}
+
+static DUE_HANDLER_TEXT golden_segment_t* golden_find_segment(unsigned long vaddr) {
+    int s = 0;
+    if (g_golden_index_valid) {
+        unsigned long chunk = vaddr >> GOLDEN_CHUNK_SHIFT;
+        size_t slot = golden_index_slot(chunk);
+        while (g_golden_index_segs[slot] >= 0 && g_golden_index_keys[slot] != chunk)
+            slot = (slot+1) & (GOLDEN_INDEX_SIZE-1);
+        if (g_golden_index_segs[slot] < 0)
+            return NULL;
+        s = g_golden_index_segs[slot];
+    }
+    for (; s < g_golden_num_segments && g_golden_segments[s].vaddr_start <= vaddr; s++) {
+        if (vaddr < g_golden_segments[s].vaddr_end)
+            return g_golden_segments+s;
+    }
+    return NULL;
+}
+
+static int golden_add_segment(int image, unsigned long vaddr, unsigned long size, unsigned long file_offset) {
+    //Merge with the previous section of the same image when both address and file offset are contiguous
+    if (g_golden_num_segments > 0) {
+        golden_segment_t* prev = g_golden_segments + g_golden_num_segments-1;
+        if (prev->image == image && prev->vaddr_end == vaddr && prev->file_offset + (prev->vaddr_end - prev->vaddr_start) == file_offset) {
+            prev->vaddr_end += size;
+            return 0;
+        }
+    }
+    if (g_golden_num_segments >= MAX_GOLDEN_SEGMENTS) {
+        printf("Failed to add golden segment, MAX_GOLDEN_SEGMENTS has been exceeded.\n");
+        return -4;
+    }
+    g_golden_segments[g_golden_num_segments].vaddr_start = vaddr;
+    g_golden_segments[g_golden_num_segments].vaddr_end = vaddr + size;
+    g_golden_segments[g_golden_num_segments].file_offset = file_offset;
+    g_golden_segments[g_golden_num_segments].image = image;
+    g_golden_num_segments++;
+    return 0;
+}
+
+#if defined(__linux__)
+static int golden_find_main_bias(struct dl_phdr_info* info, size_t size, void* data) {
+    if (info->dlpi_name && info->dlpi_name[0] == '\0') { //The main program is reported with an empty name
+        *(unsigned long*)data = (unsigned long)info->dlpi_addr;
+        return 1;
+    }
+    return 0;
+}
+#endif
+
+int golden_copy_init(const char* path) {
+    unsigned long load_bias = 0; //Static executables under the proxy kernel are never relocated
+#if defined(__linux__)
+    if (!path)
+        path = "/proc/self/exe";
+    dl_iterate_phdr(golden_find_main_bias, &load_bias);
+#endif
+    if (!path)
+        return -4;
+    return golden_copy_add_image(path, load_bias);
+}
+
+//Returns 0 when the image was added, 1 when an image with the same path or load bias is already indexed, -4 on failure
+int golden_copy_add_image(const char* path, unsigned long load_bias) {
+    if (!path)
+        return -4;
+    for (int i = 0; i < g_golden_num_images; i++) {
+        if (g_golden_images[i].load_bias == load_bias || strncmp(g_golden_images[i].path, path, EXPL_SIZE-1) == 0)
+            return 1;
+    }
+    if (g_golden_num_images >= MAX_GOLDEN_IMAGES) {
+        printf("Failed to add golden image %s, MAX_GOLDEN_IMAGES has been exceeded.\n", path);
+        return -4;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open golden image %s\n", path);
+        return -4;
+    }
+
+    golden_elf64_ehdr_t ehdr;
+    if (golden_read(fd, 0, &ehdr, sizeof(ehdr)) != 0 || memcmp(ehdr.e_ident, "\177ELF", 4) != 0 || ehdr.e_ident[4] != GOLDEN_ELFCLASS64 || ehdr.e_shentsize != sizeof(golden_elf64_shdr_t)) {
+        printf("Failed to add golden image %s, not a 64-bit ELF file\n", path);
+        close(fd);
+        return -4;
+    }
+
+    //On failure the segments added so far are dropped, so that the next image does not inherit them under the same index
+    int image = g_golden_num_images;
+    int num_segments = g_golden_num_segments;
+    for (uint16_t i = 0; i < ehdr.e_shnum; i++) {
+        golden_elf64_shdr_t shdr;
+        if (golden_read(fd, ehdr.e_shoff + i*sizeof(shdr), &shdr, sizeof(shdr)) != 0) {
+            printf("Failed to add golden image %s, could not read section header %u\n", path, (unsigned)i);
+            g_golden_num_segments = num_segments;
+            close(fd);
+            return -4;
+        }
+        //Only sections whose bytes are in the file, loaded into memory, and never written at runtime have a golden copy
+        if (shdr.sh_type == GOLDEN_SHT_PROGBITS && (shdr.sh_flags & GOLDEN_SHF_ALLOC) && !(shdr.sh_flags & GOLDEN_SHF_WRITE) && shdr.sh_size > 0 && shdr.sh_addr != 0) {
+            if (golden_add_segment(image, shdr.sh_addr + load_bias, shdr.sh_size, shdr.sh_offset) != 0) {
+                g_golden_num_segments = num_segments;
+                close(fd);
+                return -4;
+            }
+        }
+    }
+
+    snprintf(g_golden_images[image].path, EXPL_SIZE, "%s", path);
+    g_golden_images[image].load_bias = load_bias;
+    g_golden_images[image].fd = fd;
+    g_golden_images[image].map = NULL;
+    g_golden_images[image].map_size = 0;
+#if defined(__linux__)
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            g_golden_images[image].map = (const unsigned char*)map;
+            g_golden_images[image].map_size = (size_t)st.st_size;
+        }
+    }
+#endif
+    g_golden_num_images++;
+
+    golden_build_index();
+    return 0;
+}
+
+#if defined(__linux__)
+static int golden_add_loaded_image(struct dl_phdr_info* info, size_t size, void* data) {
+    //Skips the main program and the vDSO, which have no file path
+    int* added = (int*)data;
+    if (info->dlpi_name && strchr(info->dlpi_name, '/') && golden_copy_add_image(info->dlpi_name, (unsigned long)info->dlpi_addr) == 0)
+        (*added)++;
+    return 0;
+}
+#endif
+
+//Adds every shared library currently loaded in the process and returns how many were new. The main executable is added by
+//golden_copy_init(). Libraries that are already indexed are skipped, so this can be called again after more are loaded.
+int golden_copy_add_loaded_images() {
+#if defined(__linux__)
+    int added = 0;
+    dl_iterate_phdr(golden_add_loaded_image, &added);
+    return added;
+#else
+    return 0; //Statically linked under the proxy kernel, nothing to do
+#endif
+}
+
+//Brings the segment table and index in ahead of the first DUE, see memory_due_init()
+int golden_copy_prefault(int flags) {
+    int rc = 0;
+    rc |= memory_due_prefault(g_golden_segments, sizeof(g_golden_segments), 0, flags);
+    rc |= memory_due_prefault(g_golden_index_keys, sizeof(g_golden_index_keys), 0, flags);
+    rc |= memory_due_prefault(g_golden_index_segs, sizeof(g_golden_index_segs), 0, flags);
+    return rc;
+}
+
+//1 if the whole range lies in an indexed read-only section, whose bytes must never be written at runtime
+DUE_HANDLER_TEXT int golden_copy_contains(unsigned long vaddr, size_t size) {
+    golden_segment_t* seg = golden_find_segment(vaddr);
+    return (seg && size > 0 && vaddr + size <= seg->vaddr_end);
+}
+
+int golden_copy_lookup(unsigned long vaddr, unsigned char* dest, size_t size) {
+    if (!dest || size == 0)
+        return -4;
+    golden_segment_t* seg = golden_find_segment(vaddr);
+    if (!seg || vaddr + size > seg->vaddr_end)
+        return -4;
+
+    golden_image_t* img = g_golden_images + seg->image;
+    unsigned long offset = seg->file_offset + (vaddr - seg->vaddr_start);
+    if (img->map) {
+        if (offset + size > img->map_size)
+            return -4;
+        memcpy(dest, img->map + offset, size);
+        return 0;
+    }
+    return golden_read(img->fd, offset, dest, size);
+}
+
+int golden_copy_recover(dueinfo_t* dueinfo) {
+    if (!dueinfo || !dueinfo->valid || g_golden_num_segments == 0)
+        return -4;
+    size_t msg_size = dueinfo->recovered_message.size;
+    if (msg_size == 0 || msg_size > MAX_WORD_SIZE)
+        return -4;
+    unsigned long msg_addr = (unsigned long)(dueinfo->tf.badvaddr) - (unsigned long)(dueinfo->tf.badvaddr) % msg_size;
+    return golden_copy_lookup(msg_addr, dueinfo->recovered_message.bytes, msg_size);
+}
+
+void dump_golden_copy() {
+    for (int i = 0; i < g_golden_num_images; i++)
+        printf("Golden image %d: %s, load bias %p, %s\n", i, g_golden_images[i].path, (void*)(g_golden_images[i].load_bias), (g_golden_images[i].map ? "mapped" : "read on demand"));
+    for (int s = 0; s < g_golden_num_segments; s++)
+        printf("Golden segment %d: [%p, %p) at file offset %lu of image %d\n", s, (void*)(g_golden_segments[s].vaddr_start), (void*)(g_golden_segments[s].vaddr_end), g_golden_segments[s].file_offset, g_golden_segments[s].image);
+    printf("Golden address index: %s\n", (g_golden_index_valid ? "hashed" : "linear scan"));
+}
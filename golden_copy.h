@@ -0,0 +1,52 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Golden-copy recovery backend for DUEs in instruction and read-only data memory.
+ * The original bytes of every allocated, non-writable ELF section are served straight from the executable image on disk.
+ */
+
+#ifndef GOLDEN_COPY_H
+#define GOLDEN_COPY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define MAX_GOLDEN_IMAGES 8
+#define MAX_GOLDEN_SEGMENTS 64
+#define GOLDEN_CHUNK_SHIFT 16 //Index granularity: 64 KB of address space per slot
+#define GOLDEN_INDEX_SIZE 1024 //Must be a power of two
+
+typedef struct {
+    unsigned long vaddr_start;
+    unsigned long vaddr_end;
+    unsigned long file_offset;
+    int image;
+} golden_segment_t;
+
+typedef struct {
+    char path[EXPL_SIZE];
+    unsigned long load_bias;
+    int fd;
+    const unsigned char* map; //Read-only mapping of the whole image, NULL if not mapped (we read on demand instead)
+    size_t map_size;
+} golden_image_t;
+
+int golden_copy_init(const char* path);
+int golden_copy_add_image(const char* path, unsigned long load_bias);
+int golden_copy_add_loaded_images();
+int golden_copy_prefault(int flags);
+int golden_copy_contains(unsigned long vaddr, size_t size);
+int golden_copy_lookup(unsigned long vaddr, unsigned char* dest, size_t size);
+int golden_copy_recover(dueinfo_t* dueinfo);
+void dump_golden_copy();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -7,12 +7,25 @@
  */ 
 
 #include <memory_due.h>
+#include <approx_recovery.h>
+#include <golden_copy.h>
+#include <shadow_replica.h>
+#include <due_trial.h>
+#include <value_profile.h>
+#include <due_layout.h>
 #include "handler_template.h"
 
 DECL_DUE_INFO(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER)
 DECL_RECOVERY(YOUR_FUNCTION_NAME, YOUR_CRITICAL_VARIABLE, SOME_TYPE)
 DECL_RECOVERY(YOUR_FUNCTION_NAME, YOUR_APPROXIMABLE_VARIABLE, SOME_TYPE)
 DECL_RECOVERY(YOUR_FUNCTION_NAME, YOUR_CUSTOM_VARIABLE, SOME_TYPE)
+DECL_RECOVERY(YOUR_FUNCTION_NAME, YOUR_STRUCT_VARIABLE, SOME_STRUCT_TYPE)
+DECL_REPLICA(YOUR_FUNCTION_NAME, YOUR_CRITICAL_VARIABLE)
+DECL_APPROX_RECOVERY(YOUR_FUNCTION_NAME, YOUR_APPROXIMABLE_VARIABLE, SOME_APPROX_TYPE, APPROX_POLICY_CLOSEST_CANDIDATE)
+DECL_RECOVERY_LAYOUT(YOUR_FUNCTION_NAME, YOUR_STRUCT_VARIABLE, SOME_STRUCT_TYPE,
+    DUE_FIELD(SOME_STRUCT_TYPE, key, APPROX_TYPE_UNSIGNED_LONG, DUE_FIELD_POLICY_CRASH),
+    DUE_FIELD_APPROX(SOME_STRUCT_TYPE, value, APPROX_TYPE_DOUBLE, APPROX_POLICY_LINEAR_INTERP),
+    DUE_FIELD(SOME_STRUCT_TYPE, flags, APPROX_TYPE_INT, DUE_FIELD_POLICY_SYSTEM))
 
 int DUE_RECOVERY_HANDLER(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, dueinfo_t *recovery_context) {
     /*********** These must come first for macros to work properly  ************/
@@ -28,24 +41,41 @@ int DUE_RECOVERY_HANDLER(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, dueinfo_t *recover
     DEFAULT_DUE_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, recovery_context)
     /***************************************************************************/
     
-    /********************** CORRECTNESS-CRITICAL -- FORCE CRASH ****************/
+    /********* CORRECTNESS-CRITICAL -- RECOVER FROM REPLICA, ELSE FORCE CRASH ****/
     if (DUE_IN(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_CRITICAL_VARIABLE)) {
         DUE_IN_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_CRITICAL_VARIABLE, SOME_TYPE, recovery_context)
         variable_matches++;
-        recovery_context->recovery_mode = -1;
+        //Only succeeds if the replica was enabled with EN_REPLICA() after EN_RECOVERY()
+        if (REPLICA_RECOVER(YOUR_FUNCTION_NAME, YOUR_CRITICAL_VARIABLE, recovery_context) == 0)
+            recovery_context->recovery_mode = 0;
+        else
+            recovery_context->recovery_mode = -1;
     }
     /***************************************************************************/
 
    
-    /***** FULLY APPROXIMABLE VARIABLES -- FALL BACK TO OS-GUIDED RECOVERY *****/
+    /***** FULLY APPROXIMABLE VARIABLES -- PREDICT FROM NEIGHBORS, ELSE FALL BACK TO OS-GUIDED RECOVERY *****/
     if (DUE_IN(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_APPROXIMABLE_VARIABLE)) {
         DUE_IN_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_APPROXIMABLE_VARIABLE, SOME_TYPE, recovery_context)
         variable_matches++;
-        recovery_context->recovery_mode = 1;
+        if (APPROX_RECOVER(YOUR_FUNCTION_NAME, YOUR_APPROXIMABLE_VARIABLE, recovery_context) == 0)
+            recovery_context->recovery_mode = 0;
+        else
+            recovery_context->recovery_mode = 1;
     }
     /***************************************************************************/
 
     
+    /***** ARRAYS OF STRUCTS -- PER-FIELD POLICIES FROM THE LAYOUT DESCRIPTOR *****/
+    if (DUE_IN(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_STRUCT_VARIABLE)) {
+        DUE_IN_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_STRUCT_VARIABLE, SOME_STRUCT_TYPE, recovery_context)
+        variable_matches++;
+        //Only works if the layout was enabled with EN_RECOVERY_LAYOUT() after EN_RECOVERY()
+        recovery_context->recovery_mode = LAYOUT_RECOVER(YOUR_FUNCTION_NAME, YOUR_STRUCT_VARIABLE, recovery_context);
+    }
+    /***************************************************************************/
+
+
     /*************** APP-DEFINED CUSTOM RECOVERY FOR SPECIFIC CASES ************/
     if (DUE_IN(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_CUSTOM_VARIABLE)) {
         DUE_IN_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, YOUR_CUSTOM_VARIABLE, SOME_TYPE, recovery_context)
@@ -69,6 +99,14 @@ int DUE_RECOVERY_HANDLER(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, dueinfo_t *recover
                 break;
             }
         }
+
+        //Optional: if no legality check picked a candidate, take the one most likely under a sampled value profile (needs DECL_VALUE_PROFILE() and PROFILE_SAMPLE() during normal execution)
+        //if (recovery_context->recovery_mode != 0 && PROFILE_RECOVER(YOUR_FUNCTION_NAME, YOUR_CUSTOM_VARIABLE, recovery_context) == 0)
+        //    recovery_context->recovery_mode = 0;
+
+        //Optional: if no cheap legality check exists, re-run the region body once per candidate in forked trials (host Linux builds only)
+        //if (recovery_context->recovery_mode != 0 && due_trial_select(recovery_context, YOUR_TRIAL_FUNCTION, NULL, NULL) >= 0)
+        //    recovery_context->recovery_mode = 0;
     }
     /***************************************************************************/
 
@@ -78,7 +116,9 @@ int DUE_RECOVERY_HANDLER(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, dueinfo_t *recover
         recovery_context->recovery_mode = -1;
         MULTIPLE_VARIABLES_DUE_SPRINTF(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, recovery_context)
     }
-    if (recovery_context->mem_type == 1) //any instruction DUE
+    if (golden_copy_recover(recovery_context) == 0) //text or read-only data: exact original message from the executable image (requires golden_copy_init() at startup)
+        recovery_context->recovery_mode = 0;
+    else if (recovery_context->mem_type == 1) //any other instruction DUE
         recovery_context->recovery_mode = 1;
     load_value_from_message(&recovery_context->recovered_message, &recovery_context->recovered_load_value, &recovery_context->cacheline, recovery_context->load_size, recovery_context->load_message_offset);
     COPY_DUE_INFO(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, recovery_context)
@@ -15,6 +15,10 @@ extern "C" {
 
 #include <memory_due.h>
 #include <minipk.h>
+#include <approx_recovery.h>
+#include <golden_copy.h>
+#include <shadow_replica.h>
+#include <due_layout.h>
 
 #define YOUR_FUNCTION_NAME foo
 #define YOUR_IDENTIFIER bar
@@ -22,12 +26,26 @@ extern "C" {
 #define YOUR_APPROXIMABLE_VARIABLE approx_var
 #define YOUR_CUSTOM_VARIABLE custom_var
 #define SOME_TYPE unsigned long 
+#define YOUR_STRUCT_VARIABLE struct_var
+#define SOME_STRUCT_TYPE your_struct_t
+
+//Stand-in for your own struct, stored as an array of structs in YOUR_STRUCT_VARIABLE
+typedef struct {
+    unsigned long key;
+    double value;
+    int flags;
+} your_struct_t;
+#define SOME_APPROX_TYPE APPROX_TYPE_UNSIGNED_LONG
 
 //Declare relevant global data structures that are needed for DUE handlers at runtime (but extern -- they should be defined in handlers.c)
 DECL_DUE_INFO_EXTERN(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER)
 DECL_RECOVERY_EXTERN(YOUR_FUNCTION_NAME, YOUR_CRITICAL_VARIABLE, SOME_TYPE)
 DECL_RECOVERY_EXTERN(YOUR_FUNCTION_NAME, YOUR_APPROXIMABLE_VARIABLE, SOME_TYPE)
 DECL_RECOVERY_EXTERN(YOUR_FUNCTION_NAME, YOUR_CUSTOM_VARIABLE, SOME_TYPE)
+DECL_RECOVERY_EXTERN(YOUR_FUNCTION_NAME, YOUR_STRUCT_VARIABLE, SOME_STRUCT_TYPE)
+DECL_REPLICA_EXTERN(YOUR_FUNCTION_NAME, YOUR_CRITICAL_VARIABLE)
+DECL_APPROX_RECOVERY_EXTERN(YOUR_FUNCTION_NAME, YOUR_APPROXIMABLE_VARIABLE)
+DECL_RECOVERY_LAYOUT_EXTERN(YOUR_FUNCTION_NAME, YOUR_STRUCT_VARIABLE)
 
 //Declare handler functions
 int DUE_RECOVERY_HANDLER(YOUR_FUNCTION_NAME, YOUR_IDENTIFIER, dueinfo_t *recovery_context);
@@ -5,12 +5,32 @@
 
 #include "memory_due.h"
 #include "minipk.h"
+#include "due_trace.h"
+#include "page_retire.h"
+#include "golden_copy.h"
+#include "due_adaptive.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-due_handler_t g_handler_stack[MAX_REGISTERED_HANDLERS]; 
-int g_handler_sp = -1;
+#if !defined(__riscv)
+#include <time.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+static DUE_THREAD_LOCAL due_task_context_t g_default_due_context = { .sp = -1 };
+DUE_THREAD_LOCAL due_task_context_t* g_current_due_context = NULL; //NULL means the thread's default context
+DUE_THREAD_LOCAL due_handler_t* g_handler_stack = NULL;
+DUE_THREAD_LOCAL int g_handler_sp = -1;
+due_region_t* g_static_regions[MAX_STATIC_DUE_REGIONS];
+int g_static_region_parents[MAX_STATIC_DUE_REGIONS];
+size_t g_num_static_regions = 0;
+
+//Static because we don't want these allocated on the stack in trap context. At file scope so that memory_due_init() can prefault them.
+static dueinfo_t g_user_context; //Large data structure
+static due_handler_t g_static_setup; //Setup for a DUE in a static region
+static word_t g_message_in; //Original OS-provided message, only kept when recording a trace
 
 void dump_dueinfo(dueinfo_t* dueinfo) {
     if (dueinfo && dueinfo->valid) {
@@ -104,9 +124,194 @@ void dump_dueinfo(dueinfo_t* dueinfo) {
         printf("No valid DUE info.\n");
 }
 
+void register_memory_due_trap_handler() {
+    //First invocation only
+    static int init = 0;
+    if (!init) {
+#if defined(__riscv)
+        user_trap_handler entry_trap_fptr = &memory_due_handler_entry;
+        asm volatile("or a0, zero, %0;" //Load default entry trap handler fptr into register a0
+                     "li a7, 447;" //Load syscall number 447 (SYS_register_user_memory_due_trap_handler) into register a7
+                     "ecall;" //Make RISC-V environment call to register our user-defined trap handler
+                     :
+                     : "r" (entry_trap_fptr));
+#endif
+        init = 1;
+    }
+}
+
+//Table order: by start PC, and the longer region first when two start together. Region labels emit no code, so nested regions opened
+//back to back share a start PC, and the outer one must come first for due_region_table_link() to make it the parent.
+int due_region_before(const due_region_t* a, const due_region_t* b) {
+    return (a->pc_start < b->pc_start || (a->pc_start == b->pc_start && a->pc_end > b->pc_end));
+}
+
+//Collects the regions described by BEGIN_STATIC_DUE_RECOVERY from the due_regions linker section and sorts them by start PC
+__attribute__((constructor)) void init_static_due_regions() {
+    static int init = 0;
+    if (init)
+        return;
+    init = 1;
+    g_num_static_regions = 0;
+    if (!__start_due_regions || !__stop_due_regions)
+        return;
+    for (due_region_t** it = __start_due_regions; it < __stop_due_regions; it++) {
+        if (g_num_static_regions >= MAX_STATIC_DUE_REGIONS) {
+            printf("Failed to add static DUE region %s, MAX_STATIC_DUE_REGIONS has been exceeded.\n", (*it)->name);
+            break;
+        }
+        size_t i = g_num_static_regions;
+        while (i > 0 && due_region_before(*it, g_static_regions[i-1])) {
+            g_static_regions[i] = g_static_regions[i-1];
+            i--;
+        }
+        g_static_regions[i] = *it;
+        g_num_static_regions++;
+    }
+    due_region_table_link(g_static_regions, g_static_region_parents, g_num_static_regions);
+    if (g_num_static_regions > 0)
+        register_memory_due_trap_handler();
+}
+
+//Touches every page of [start, start+size) so that none of it is unmapped (or copy-on-write, if writable) at the first DUE.
+//Optionally locks the pages and reads every cacheline.
+int memory_due_prefault(void* start, size_t size, int writable, int flags) {
+    if (!start || size == 0)
+        return 0;
+    unsigned long first = (unsigned long)start & ~((unsigned long)DUE_PAGE_SIZE-1);
+    unsigned long end = (unsigned long)start + size;
+    int rc = 0;
+    if (flags & MEMORY_DUE_INIT_PREFAULT) {
+        for (unsigned long page = first; page < end; page += DUE_PAGE_SIZE) {
+            volatile unsigned char* p = (volatile unsigned char*)(page < (unsigned long)start ? (unsigned long)start : page);
+            unsigned char v = *p;
+            if (writable)
+                *p = v;
+        }
+    }
+    if (flags & MEMORY_DUE_INIT_LOCK) {
+#if defined(__linux__)
+        if (mlock((void*)first, end-first) != 0) {
+            printf("Failed to lock %lu bytes of the DUE handler path at %p in memory\n", end-first, (void*)first);
+            rc = -4;
+        }
+#endif
+    }
+    if (flags & MEMORY_DUE_INIT_WARM) {
+        for (unsigned long line = (unsigned long)start & ~((unsigned long)DUE_CACHELINE_SIZE-1); line < end; line += DUE_CACHELINE_SIZE)
+            (void)*(volatile unsigned char*)(line < (unsigned long)start ? (unsigned long)start : line);
+    }
+    return rc;
+}
+
+//Writes to the stack below our frame, where the user handler will run, so that it is mapped before the first DUE
+__attribute__((noinline)) static void memory_due_prefault_stack() {
+    volatile unsigned char buf[DUE_STACK_PREFAULT_SIZE];
+    for (size_t i = 0; i < DUE_STACK_PREFAULT_SIZE; i += DUE_PAGE_SIZE)
+        buf[i] = 0;
+    buf[DUE_STACK_PREFAULT_SIZE-1] = 0;
+    (void)buf[0];
+}
+
+//Eager alternative to registering at the first push: registers the entry point now, and brings the handler path's code, contexts
+//and region tables in ahead of time so that the first DUE costs the same as later ones. Safe to call more than once.
+int memory_due_init(int flags) {
+    int rc = 0;
+    init_static_due_regions();
+    if (flags & MEMORY_DUE_INIT_REGISTER)
+        register_memory_due_trap_handler();
+    if (!(flags & (MEMORY_DUE_INIT_PREFAULT | MEMORY_DUE_INIT_LOCK | MEMORY_DUE_INIT_WARM)))
+        return rc;
+
+    if (!g_handler_stack)
+        due_task_context_switch(NULL);
+    if (__start_due_handler_text && __stop_due_handler_text)
+        rc |= memory_due_prefault(__start_due_handler_text, (size_t)(__stop_due_handler_text - __start_due_handler_text), 0, flags);
+    rc |= memory_due_prefault(&g_user_context, sizeof(g_user_context), 1, flags);
+    rc |= memory_due_prefault(&g_static_setup, sizeof(g_static_setup), 1, flags);
+    rc |= memory_due_prefault(&g_message_in, sizeof(g_message_in), 1, flags);
+    rc |= memory_due_prefault(g_handler_stack, MAX_REGISTERED_HANDLERS*sizeof(due_handler_t), 1, flags);
+    rc |= memory_due_prefault(g_static_regions, g_num_static_regions*sizeof(due_region_t*), 0, flags);
+    rc |= memory_due_prefault(g_static_region_parents, g_num_static_regions*sizeof(int), 0, flags);
+    for (size_t i = 0; i < g_num_static_regions; i++) {
+        rc |= memory_due_prefault(g_static_regions[i], sizeof(due_region_t), 1, flags);
+        rc |= memory_due_prefault((void*)(g_static_regions[i]->fptr), DUE_HANDLER_PREFAULT_SIZE, 0, flags); //Handler size is unknown, take its first bytes
+    }
+    for (int i = 0; i <= g_handler_sp; i++)
+        rc |= memory_due_prefault((void*)(g_handler_stack[i].fptr), DUE_HANDLER_PREFAULT_SIZE, 0, flags);
+    rc |= due_trace_prefault(flags); //State of the optional stages that run inside the entry
+    rc |= due_retire_prefault(flags);
+    rc |= golden_copy_prefault(flags);
+    rc |= due_adaptive_prefault(flags);
+    if (flags & MEMORY_DUE_INIT_PREFAULT)
+        memory_due_prefault_stack();
+    return (rc != 0 ? -4 : 0);
+}
+
+//Links each region of a table sorted by pc_start to the innermost earlier region that contains its start, or -1. Open regions are
+//kept on a stack, so this is linear in the table size.
+void due_region_table_link(due_region_t** regions, int* parents, size_t n) {
+    static int open[MAX_STATIC_DUE_REGIONS];
+    size_t depth = 0;
+    for (size_t i = 0; i < n && i < MAX_STATIC_DUE_REGIONS; i++) {
+        while (depth > 0 && regions[open[depth-1]]->pc_end <= regions[i]->pc_start)
+            depth--;
+        parents[i] = (depth > 0 ? open[depth-1] : -1);
+        open[depth++] = (int)i;
+    }
+}
+
+//Innermost region of a linked table containing pc, or NULL. Binary search for the last region starting at or before pc, then follow
+//parent links out of the regions that end before pc, so the cost is the nesting depth rather than the table size.
+DUE_HANDLER_TEXT due_region_t* due_region_table_find(due_region_t** regions, const int* parents, size_t n, void* pc) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        if (regions[mid]->pc_start <= pc)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    for (int i = (int)lo-1; i >= 0; i = parents[i]) {
+        if (pc < regions[i]->pc_end)
+            return regions[i];
+    }
+    return NULL;
+}
+
+//Innermost static region containing pc, or NULL
+DUE_HANDLER_TEXT due_region_t* find_static_due_region(void* pc) {
+    return due_region_table_find(g_static_regions, g_static_region_parents, g_num_static_regions, pc);
+}
+
+void due_task_context_init(due_task_context_t* ctx) {
+    if (ctx) {
+        memset(ctx->stack, 0, sizeof(ctx->stack));
+        ctx->sp = -1;
+    }
+}
+
+//Cheap enough to call on every task switch: a handful of stores and no copying of handler stacks
+due_task_context_t* due_task_context_switch(due_task_context_t* next) {
+    due_task_context_t* prev = (g_current_due_context ? g_current_due_context : &g_default_due_context);
+    if (!next)
+        next = &g_default_due_context;
+    prev->sp = g_handler_sp;
+    g_handler_sp = -1; //A DUE in the middle of the switch sees no pushed handlers rather than a mismatched stack and sp
+    asm volatile("" ::: "memory");
+    g_current_due_context = next;
+    g_handler_stack = next->stack;
+    asm volatile("" ::: "memory");
+    g_handler_sp = next->sp;
+    return prev;
+}
+
 void push_user_memory_due_trap_handler(const char* name, user_defined_trap_handler fptr, void* pc_start, void* pc_end, due_region_strictness_t strict) {
     //TODO FIXME: How to deal with memory errors in this function? It happens somewhat often..
     //TODO FIXME: memory barriers, atomicity, etc
+    if (!g_handler_stack) //No task context attached yet on this thread
+        due_task_context_switch(NULL);
     if (g_handler_sp+1 >= MAX_REGISTERED_HANDLERS) {
         printf("Failed to push new DUE handler, MAX_REGISTERED_HANDLERS has been exceeded.\n");
         return;
@@ -124,17 +329,7 @@ void push_user_memory_due_trap_handler(const char* name, user_defined_trap_handl
     g_handler_stack[g_handler_sp+1].pc_end = pc_end;
     g_handler_stack[g_handler_sp+1].restart = 0; //Set decision should be made by user at time of DUE
 
-    //First invocation only
-    static int init = 0;
-    if (!init) {
-        user_trap_handler entry_trap_fptr = &memory_due_handler_entry;
-        asm volatile("or a0, zero, %0;" //Load default entry trap handler fptr into register a0
-                     "li a7, 447;" //Load syscall number 447 (SYS_register_user_memory_due_trap_handler) into register a7
-                     "ecall;" //Make RISC-V environment call to register our user-defined trap handler
-                     :
-                     : "r" (entry_trap_fptr));
-        init = 1;
-    }
+    register_memory_due_trap_handler();
     g_handler_sp++;
 }
 
@@ -150,124 +345,174 @@ void pop_user_memory_due_trap_handler() {
     g_handler_sp--;
 }
 
-int memory_due_handler_entry(trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* recovered_message, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type) {
-    if (g_handler_sp < 0 || g_handler_sp >= MAX_REGISTERED_HANDLERS) //probably our fault
-        return -4;
-
-    //TODO FIXME: How to deal with memory errors in this function? Re-entrant, etc.
-    static dueinfo_t user_context; //Static because we don't want this allocated on the stack, it is a large data structure
+//Fills in a user context from the OS-provided arguments and the given handler setup. Also used to replay recorded DUE traces.
+DUE_HANDLER_TEXT int init_dueinfo(dueinfo_t* user_context, trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* recovered_message, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type, due_handler_t* setup, int handler_sp) {
+    if (!user_context || !setup)
+        return 0;
     int success = 1;
 
     //Init to safe values: passed up as arguments from the OS
-    user_context.valid = 0;
-    user_context.tf.badvaddr = 0;
-    user_context.tf.epc = 0;
-    user_context.tf.insn = 0;
-    user_context.tf.cause = 0;
-    //user_context.float_tf //nothing to do
-    user_context.demand_vaddr = 0;
-    user_context.candidates.size = 0;
-    user_context.cacheline.size = 0;
-    user_context.recovered_message.size = 0;
-    user_context.load_size = 0;
-    user_context.load_dest_reg = 0;
-    user_context.float_regfile = 0;
-    user_context.load_message_offset = 0;
-    user_context.mem_type = -1;
+    user_context->valid = 0;
+    user_context->tf.badvaddr = 0;
+    user_context->tf.epc = 0;
+    user_context->tf.insn = 0;
+    user_context->tf.cause = 0;
+    //user_context->float_tf //nothing to do
+    user_context->demand_vaddr = 0;
+    user_context->candidates.size = 0;
+    user_context->cacheline.size = 0;
+    user_context->recovered_message.size = 0;
+    user_context->load_size = 0;
+    user_context->load_dest_reg = 0;
+    user_context->float_regfile = 0;
+    user_context->load_message_offset = 0;
+    user_context->mem_type = -1;
 
     //Init to safe values: set by userspace
-    user_context.setup.name[0] = '\0';
-    user_context.setup.fptr = NULL;
-    user_context.setup.strict = 1;
-    user_context.setup.pc_start = NULL;
-    user_context.setup.pc_end = NULL;
-    user_context.setup.restart = 0;
-    user_context.setup.invocations = 0;
-    user_context.setup.handler_sp_when_invoked = 0;
-    user_context.recovered_load_value.size = 0;
-    user_context.error_in_stack = 0;
-    user_context.error_in_text = 0;
-    user_context.error_in_data = 0;
-    user_context.error_in_sdata = 0;
-    user_context.error_in_bss = 0;
-    user_context.error_in_heap = 0;
-    user_context.recovery_mode = -1;
-    user_context.type_name[0] = '\0';
-    user_context.expl[0] = '\0';
+    user_context->setup.name[0] = '\0';
+    user_context->setup.fptr = NULL;
+    user_context->setup.strict = 1;
+    user_context->setup.pc_start = NULL;
+    user_context->setup.pc_end = NULL;
+    user_context->setup.restart = 0;
+    user_context->setup.invocations = 0;
+    user_context->setup.handler_sp_when_invoked = 0;
+    user_context->recovered_load_value.size = 0;
+    user_context->error_in_stack = 0;
+    user_context->error_in_text = 0;
+    user_context->error_in_data = 0;
+    user_context->error_in_sdata = 0;
+    user_context->error_in_bss = 0;
+    user_context->error_in_heap = 0;
+    user_context->recovery_mode = -1;
+    user_context->type_name[0] = '\0';
+    user_context->expl[0] = '\0';
 
     //Copy arguments from OS
-    success = success & ((tf && copy_trapframe(&user_context.tf, tf) == 0) ? 1 : 0); 
-    success = success & ((float_tf && copy_float_trapframe(&user_context.float_tf, float_tf) == 0) ? 1 : 0);
-    user_context.demand_vaddr = demand_vaddr;
-    success = success & ((candidates && copy_candidates(&user_context.candidates, candidates) == 0) ? 1 : 0);
-    success = success & ((cacheline && copy_cacheline(&user_context.cacheline, cacheline) == 0) ? 1 : 0);
-    success = success & ((copy_word(&user_context.recovered_message, recovered_message) == 0) ? 1 : 0);
-    user_context.load_size = load_size;
-    user_context.load_dest_reg = load_dest_reg;
-    user_context.float_regfile = float_regfile;
-    user_context.load_message_offset = load_message_offset;
-    user_context.mem_type = mem_type;
+    success = success & ((tf && copy_trapframe(&user_context->tf, tf) == 0) ? 1 : 0); 
+    success = success & ((float_tf && copy_float_trapframe(&user_context->float_tf, float_tf) == 0) ? 1 : 0);
+    user_context->demand_vaddr = demand_vaddr;
+    success = success & ((candidates && copy_candidates(&user_context->candidates, candidates) == 0) ? 1 : 0);
+    success = success & ((cacheline && copy_cacheline(&user_context->cacheline, cacheline) == 0) ? 1 : 0);
+    success = success & ((copy_word(&user_context->recovered_message, recovered_message) == 0) ? 1 : 0);
+    user_context->load_size = load_size;
+    user_context->load_dest_reg = load_dest_reg;
+    user_context->float_regfile = float_regfile;
+    user_context->load_message_offset = load_message_offset;
+    user_context->mem_type = mem_type;
 
     //Copy DUE handler setup context
-    memcpy(user_context.setup.name, g_handler_stack[g_handler_sp].name, NAME_SIZE-1);
-    user_context.setup.name[NAME_SIZE-1] = '\0';
-    user_context.setup.fptr = g_handler_stack[g_handler_sp].fptr;
-    user_context.setup.strict = g_handler_stack[g_handler_sp].strict;
-    user_context.setup.pc_start = g_handler_stack[g_handler_sp].pc_start;
-    user_context.setup.pc_end = g_handler_stack[g_handler_sp].pc_end;
-    user_context.setup.restart = g_handler_stack[g_handler_sp].restart;
-    //user_context.setup.invocations //nothing to do, set by user-defined handler
-    user_context.setup.handler_sp_when_invoked = g_handler_sp;
+    memcpy(user_context->setup.name, setup->name, NAME_SIZE-1);
+    user_context->setup.name[NAME_SIZE-1] = '\0';
+    user_context->setup.fptr = setup->fptr;
+    user_context->setup.strict = setup->strict;
+    user_context->setup.pc_start = setup->pc_start;
+    user_context->setup.pc_end = setup->pc_end;
+    user_context->setup.restart = setup->restart;
+    //user_context->setup.invocations //nothing to do, set by user-defined handler
+    user_context->setup.handler_sp_when_invoked = handler_sp;
 
     //Check arguments for correctness
-    success = success & ((user_context.mem_type == 0 || user_context.mem_type == 1) ? 1 : 0);
-    success = success & ((user_context.load_size <= sizeof(unsigned long)) ? 1 : 0);
-    success = success & ((user_context.float_regfile == 0 || user_context.float_regfile == 1) ? 1 : 0);
-    success = success & (((user_context.float_regfile == 0 && user_context.load_dest_reg <= NUM_GPR) || (user_context.float_regfile == 1 && user_context.load_dest_reg <= NUM_FPR)) ? 1 : 0);
+    success = success & ((user_context->mem_type == 0 || user_context->mem_type == 1) ? 1 : 0);
+    success = success & ((user_context->load_size <= sizeof(unsigned long)) ? 1 : 0);
+    success = success & ((user_context->float_regfile == 0 || user_context->float_regfile == 1) ? 1 : 0);
+    success = success & (((user_context->float_regfile == 0 && user_context->load_dest_reg <= NUM_GPR) || (user_context->float_regfile == 1 && user_context->load_dest_reg <= NUM_FPR)) ? 1 : 0);
 
     //Analyze trap frame, determine in which segment the memory DUE occured
     if (success) {
-        void* badvaddr = (void*)(user_context.tf.badvaddr);
-        if (badvaddr >= (void*)(user_context.tf.gpr[2]) && badvaddr < (void*)(user_context.tf.gpr[2]+64)) //gpr[2] is sp. TODO: how to find size of stack frame dynamically, or otherwise find the base of stack? Right now we look 0 to +64 bytes from the tf's sp (because it grows down)
-            user_context.error_in_stack = 1;
+        void* badvaddr = (void*)(user_context->tf.badvaddr);
+        if (badvaddr >= (void*)(user_context->tf.gpr[2]) && badvaddr < (void*)(user_context->tf.gpr[2]+64)) //gpr[2] is sp. TODO: how to find size of stack frame dynamically, or otherwise find the base of stack? Right now we look 0 to +64 bytes from the tf's sp (because it grows down)
+            user_context->error_in_stack = 1;
         if (badvaddr >= (void*)(&_ftext) && badvaddr < (void*)(&_etext))
-            user_context.error_in_text = 1;
+            user_context->error_in_text = 1;
         if (badvaddr >= (void*)(&_fdata) && badvaddr < (void*)(&_edata))
-            user_context.error_in_data = 1;
+            user_context->error_in_data = 1;
         if (badvaddr >= (void*)(&_edata) && badvaddr < (void*)(&_fbss))
-            user_context.error_in_sdata = 1;
+            user_context->error_in_sdata = 1;
         if (badvaddr >= (void*)(&_fbss) && badvaddr < (void*)(&_end))
-            user_context.error_in_bss = 1;
-        user_context.error_in_heap = 0; //TODO
+            user_context->error_in_bss = 1;
+        user_context->error_in_heap = 0; //TODO
+    }
+
+    user_context->valid = success;
+    return success;
+}
+
+DUE_HANDLER_TEXT int memory_due_handler_entry(trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* recovered_message, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type) {
+    if (g_handler_sp >= MAX_REGISTERED_HANDLERS || !tf) //probably our fault
+        return -4;
+
+    //Noted before any early return, DUEs without a handler are what drive a coarse adaptive region to fine mode
+    if (g_due_adaptive_enabled)
+        due_adaptive_note(tf, (g_handler_sp >= 0 ? g_handler_stack[g_handler_sp].pc_start : NULL));
+
+    //The innermost scope wins. A static region nested inside the pushed handler's region beats it, the pushed handler beats a static
+    //region around it, and the top of the handler stack is the fallback for DUEs in subroutines of a pushed region, as always.
+    //A fine-grained adaptive region is both pushed and static with the same bounds, and must go through its stack slot to restart.
+    void* pc = (void*)(tf->epc);
+    due_region_t* region = find_static_due_region(pc);
+    due_handler_t* setup = NULL;
+    int handled = 1;
+    int region_inside_top = 0;
+    if (g_handler_sp >= 0 && region) {
+        due_handler_t* top = g_handler_stack+g_handler_sp;
+        region_inside_top = (region->pc_start >= top->pc_start && region->pc_end <= top->pc_end && (region->pc_start != top->pc_start || region->pc_end != top->pc_end));
     }
+    if (g_handler_sp >= 0 && (!region || (!region_inside_top && pc >= g_handler_stack[g_handler_sp].pc_start && pc < g_handler_stack[g_handler_sp].pc_end))) {
+        setup = g_handler_stack+g_handler_sp;
+        region = NULL;
+    } else if (region) {
+        snprintf(g_static_setup.name, NAME_SIZE, "%s", region->name);
+        g_static_setup.fptr = region->fptr;
+        g_static_setup.strict = region->strict;
+        g_static_setup.pc_start = region->pc_start;
+        g_static_setup.pc_end = region->pc_end;
+        g_static_setup.restart = region->restart;
+        setup = &g_static_setup;
+    } else { //No handler at all, still traced under an empty name so that the DUE shows up in the record
+        memset(&g_static_setup, 0, sizeof(g_static_setup));
+        setup = &g_static_setup;
+        handled = 0;
+    }
+
+    //TODO FIXME: How to deal with memory errors in this function? Re-entrant, etc.
+    if (g_due_trace_recording)
+        copy_word(&g_message_in, recovered_message);
+    init_dueinfo(&g_user_context, tf, float_tf, demand_vaddr, candidates, cacheline, recovered_message, load_size, load_dest_reg, float_regfile, load_message_offset, mem_type, setup, g_handler_sp);
 
-    user_context.valid = success;
-    
     //Call user handler if we are not in strict mode or PC in error occurred in the registered PC range
-    if (user_context.valid == 1) {
-        user_defined_trap_handler fptr = user_context.setup.fptr;
-        void* epc = (void*)(user_context.tf.epc);
-        void* pc_start = (void*)(user_context.setup.pc_start);
-        void* pc_end = (void*)(user_context.setup.pc_end);
-        due_region_strictness_t strict = user_context.setup.strict;
+    if (!handled) {
+        g_user_context.recovery_mode = -4;
+    } else if (g_user_context.valid == 1) {
+        user_defined_trap_handler fptr = g_user_context.setup.fptr;
+        void* epc = (void*)(g_user_context.tf.epc);
+        void* pc_start = (void*)(g_user_context.setup.pc_start);
+        void* pc_end = (void*)(g_user_context.setup.pc_end);
+        due_region_strictness_t strict = g_user_context.setup.strict;
         if (fptr) {
             if (strict == STRICTNESS_DEFAULT || (epc >= pc_start && epc < pc_end)) {
-                user_context.recovery_mode = fptr(&user_context);
-                copy_word(recovered_message, &(user_context.recovered_message));
-                return user_context.recovery_mode;
+                g_user_context.recovery_mode = fptr(&g_user_context);
+                copy_word(recovered_message, &(g_user_context.recovered_message));
+                if (region && g_user_context.setup.restart == 1) //Static regions have no stack slot for the handler to flag directly
+                    region->restart = 1;
+                if (g_due_retire_enabled)
+                    due_retire_note(&g_user_context);
             } else {
-                return -3; //Out-of-bounds handler
-            }   
+                g_user_context.recovery_mode = -3; //Out-of-bounds handler
+            }
         } else {
             //If we got here but fptr is NULL, then user did not successfully register handler..
-            user_context.recovery_mode = -2; 
-            return user_context.recovery_mode;
+            g_user_context.recovery_mode = -2;
         }
+    } else {
+        //Handler problem, not app's fault
+        g_user_context.recovery_mode = -4;
     }
 
-    //Handler problem, not app's fault
-    user_context.recovery_mode = -4;
-    return user_context.recovery_mode;
+    //Every DUE is traced with the mode we return, the failures are the ones most worth replaying
+    if (g_due_trace_recording)
+        due_trace_record(tf, float_tf, demand_vaddr, candidates, cacheline, &g_message_in, load_size, load_dest_reg, float_regfile, load_message_offset, mem_type, setup, g_user_context.recovery_mode, recovered_message);
+    return g_user_context.recovery_mode;
 }
 
 void dump_word(word_t* w) {
@@ -389,7 +634,14 @@ void dump_float_regs(float_trapframe_t* float_tf) {
 
 unsigned long get_sim_tick_counter() {
     unsigned long tick;
+#if defined(__riscv)
     asm volatile("csrr %0, 0xa" : "=r"(tick)); 
+#else
+    //Host builds (e.g., trace replay): nanoseconds stand in for simulator ticks
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tick = (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+#endif
     return tick;
 }
 
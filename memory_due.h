@@ -17,6 +17,25 @@ extern "C" {
 #define NAME_SIZE 64
 #define EXPL_SIZE 256
 #define MAX_REGISTERED_HANDLERS 8
+#define MAX_STATIC_DUE_REGIONS 256
+#define DUE_PAGE_SIZE 4096
+#define DUE_CACHELINE_SIZE 64
+#define DUE_STACK_PREFAULT_SIZE 16384 //Stack below the caller of memory_due_init() that is touched for the user handler
+#define DUE_HANDLER_PREFAULT_SIZE 1024 //Bytes of each user handler's code that are prefaulted
+
+//Flags for memory_due_init()
+#define MEMORY_DUE_INIT_REGISTER 0x1 //Register the entry point with the kernel now instead of at the first push
+#define MEMORY_DUE_INIT_PREFAULT 0x2 //Touch every page of the handler path, its contexts and region tables
+#define MEMORY_DUE_INIT_LOCK 0x4 //Lock those pages in memory, where the platform supports it
+#define MEMORY_DUE_INIT_WARM 0x8 //Read every cacheline of them
+#define MEMORY_DUE_INIT_ALL 0xf
+
+//Define MEMORY_DUE_THREAD_LOCAL when tasks run on several threads, so that each thread has its own running task context
+#if defined(MEMORY_DUE_THREAD_LOCAL)
+#define DUE_THREAD_LOCAL __thread
+#else
+#define DUE_THREAD_LOCAL
+#endif
 
 typedef enum {
     STRICTNESS_DEFAULT,
@@ -40,6 +59,22 @@ struct due_handler {
     int handler_sp_when_invoked;
 };
 
+//Recovery scope of one task or coroutine: its own handler stack, saved and restored by due_task_context_switch()
+typedef struct {
+    due_handler_t stack[MAX_REGISTERED_HANDLERS];
+    int sp;
+} due_task_context_t;
+
+//Statically described DUE region, see BEGIN_STATIC_DUE_RECOVERY
+typedef struct {
+    const char* name;
+    user_defined_trap_handler fptr;
+    due_region_strictness_t strict;
+    void* pc_start;
+    void* pc_end;
+    int restart;
+} due_region_t;
+
 struct dueinfo {
     int valid;
 
@@ -123,6 +158,34 @@ struct dueinfo {
     } \
     pop_user_memory_due_trap_handler();
 
+#define DUE_REGION_DESC(fname, seqnum) fname ## _ ## seqnum ## _ ## region
+#define DUE_REGION_DESC_PTR(fname, seqnum) fname ## _ ## seqnum ## _ ## region_ptr
+
+//Zero-cost alternative to BEGIN_DUE_RECOVERY/END_DUE_RECOVERY: the region is described at link time in the due_regions section and
+//found by PC when a DUE arrives, so nothing is pushed or popped on entry. Use push/pop only for dynamically scoped cases, e.g., DUEs
+//expected in subroutines. The enclosing function must not be inlined or cloned, so that the label addresses stay unique.
+#define BEGIN_STATIC_DUE_RECOVERY(fname, seqnum, strict) \
+    static due_region_t DUE_REGION_DESC(fname, seqnum) = { STRINGIFY(FUNCTION_DUE_RECOVERY_NAME(fname, seqnum)), FUNCTION_DUE_RECOVERY_NAME(fname, seqnum), strict, &&START_DUE_REGION_LABEL(fname, seqnum), &&END_DUE_REGION_LABEL(fname, seqnum), 0 }; \
+    static due_region_t* const DUE_REGION_DESC_PTR(fname, seqnum) __attribute__((section("due_regions"), used)) = &DUE_REGION_DESC(fname, seqnum); \
+    START_DUE_REGION_LABEL(fname,seqnum):;
+
+#define END_STATIC_DUE_RECOVERY(fname,seqnum) \
+    END_DUE_REGION_LABEL(fname,seqnum):; \
+    if (DUE_REGION_DESC(fname, seqnum).restart == 1) { \
+        DUE_REGION_DESC(fname, seqnum).restart = 0; \
+        printf("Restarting DUE trap region!\n"); \
+        goto *(DUE_REGION_DESC(fname, seqnum).pc_start); \
+    }
+
+//Call from the task runtime whenever a task or coroutine is resumed, with the context embedded in its frame. NULL resumes the
+//thread's default context. The pushed handlers of the suspended task stay in its own context until it is resumed.
+#define DUE_TASK_CONTEXT_SWITCH(ctx) \
+    due_task_context_switch(ctx);
+
+//Runs memory_due_init() from a constructor, before main(). Use once per program.
+#define MEMORY_DUE_EAGER_INIT(flags) \
+    __attribute__((constructor)) static void memory_due_eager_init() { memory_due_init(flags); }
+
 #define DUE_INFO(fname, seqnum) fname ## _ ## seqnum ## _ ## dueinfo
 
 #define DECL_DUE_INFO(fname, seqnum) \
@@ -131,6 +194,10 @@ struct dueinfo {
 #define DECL_DUE_INFO_EXTERN(fname, seqnum) \
     extern dueinfo_t DUE_INFO(fname, seqnum);
 
+//Per-region DUE_INFO globals are not known to the library, so eager init of them is opt-in
+#define PREFAULT_DUE_INFO(fname, seqnum) \
+    memory_due_prefault(&DUE_INFO(fname, seqnum), sizeof(dueinfo_t), 1, MEMORY_DUE_INIT_ALL);
+
 #define COPY_DUE_INFO(fname, seqnum, src) \
     DUE_INFO(fname, seqnum).valid = 0; \
     if (src) { \
@@ -202,19 +269,38 @@ struct dueinfo {
 
 
 
-//Useful symbols defined by the RISC-V linker script
-extern void* _ftext; //Front of code segment
-extern void* _etext; //End of code segment
-extern void* _fdata; //Front of initialized data segment
-extern void* _edata; //End of initialized data segment
-extern void* _fbss; //Front of uninitialized data segment
-extern void* _end; //End of uninitialized data segment... and address space overall?
-extern due_handler_t g_handler_stack[MAX_REGISTERED_HANDLERS];
-extern int g_handler_sp;
+//Useful symbols defined by the RISC-V linker script. Weak so that host builds (e.g., trace replay) still link without it.
+extern void* _ftext __attribute__((weak)); //Front of code segment
+extern void* _etext __attribute__((weak)); //End of code segment
+extern void* _fdata __attribute__((weak)); //Front of initialized data segment
+extern void* _edata __attribute__((weak)); //End of initialized data segment
+extern void* _fbss __attribute__((weak)); //Front of uninitialized data segment
+extern void* _end __attribute__((weak)); //End of uninitialized data segment... and address space overall?
+extern DUE_THREAD_LOCAL due_handler_t* g_handler_stack; //Handler stack of the running task, NULL until the first push or switch
+extern DUE_THREAD_LOCAL int g_handler_sp;
+extern DUE_THREAD_LOCAL due_task_context_t* g_current_due_context;
+extern due_region_t* g_static_regions[MAX_STATIC_DUE_REGIONS]; //Sorted by pc_start
+extern int g_static_region_parents[MAX_STATIC_DUE_REGIONS]; //Index of each region's innermost enclosing region, -1 for none
+extern size_t g_num_static_regions;
+extern due_region_t* __start_due_regions[] __attribute__((weak)); //Defined by the linker when any static region exists
+extern due_region_t* __stop_due_regions[] __attribute__((weak));
+extern unsigned char __start_due_handler_text[] __attribute__((weak)); //Bounds of the code marked DUE_HANDLER_TEXT
+extern unsigned char __stop_due_handler_text[] __attribute__((weak));
 
 void dump_dueinfo(dueinfo_t* dueinfo);
+void register_memory_due_trap_handler();
+int memory_due_prefault(void* start, size_t size, int writable, int flags);
+int memory_due_init(int flags);
+void init_static_due_regions();
+int due_region_before(const due_region_t* a, const due_region_t* b);
+void due_region_table_link(due_region_t** regions, int* parents, size_t n);
+due_region_t* due_region_table_find(due_region_t** regions, const int* parents, size_t n, void* pc);
+due_region_t* find_static_due_region(void* pc);
+void due_task_context_init(due_task_context_t* ctx);
+due_task_context_t* due_task_context_switch(due_task_context_t* next);
 void push_user_memory_due_trap_handler(const char* name, user_defined_trap_handler fptr, void* pc_start, void* pc_end, due_region_strictness_t strict);
 void pop_user_memory_due_trap_handler();
+int init_dueinfo(dueinfo_t* user_context, trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* recovered_message, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type, due_handler_t* setup, int handler_sp);
 int memory_due_handler_entry(trapframe_t* tf, float_trapframe_t* float_tf, long demand_vaddr, due_candidates_t* candidates, due_cacheline_t* cacheline, word_t* recovered_message, size_t load_size, size_t load_dest_reg, int float_regfile, int load_message_offset, int mem_type);
 void dump_word(word_t* w);
 void dump_candidate_messages(due_candidates_t* cd);
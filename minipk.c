@@ -47,7 +47,7 @@ void dump_tf(trapframe_t* tf)
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int copy_word(word_t* dest, word_t* src) {
+DUE_HANDLER_TEXT int copy_word(word_t* dest, word_t* src) {
    if (dest && src && src->size <= MAX_WORD_SIZE) {
        for (size_t i = 0; i < src->size; i++)
            dest->bytes[i] = src->bytes[i];
@@ -60,7 +60,7 @@ int copy_word(word_t* dest, word_t* src) {
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int copy_cacheline(due_cacheline_t* dest, due_cacheline_t* src) {
+DUE_HANDLER_TEXT int copy_cacheline(due_cacheline_t* dest, due_cacheline_t* src) {
     if (dest && src && src->size <= MAX_CACHELINE_WORDS) {
         for (size_t i = 0; i < src->size; i++)
             copy_word(dest->words+i, src->words+i);
@@ -74,7 +74,7 @@ int copy_cacheline(due_cacheline_t* dest, due_cacheline_t* src) {
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int copy_candidates(due_candidates_t* dest, due_candidates_t* src) {
+DUE_HANDLER_TEXT int copy_candidates(due_candidates_t* dest, due_candidates_t* src) {
     if (dest && src && src->size <= MAX_CANDIDATE_MSG) {
         for (size_t i = 0; i < src->size; i++)
             copy_word(dest->candidate_messages+i, src->candidate_messages+i);
@@ -87,7 +87,7 @@ int copy_candidates(due_candidates_t* dest, due_candidates_t* src) {
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int copy_trapframe(trapframe_t* dest, trapframe_t* src) {
+DUE_HANDLER_TEXT int copy_trapframe(trapframe_t* dest, trapframe_t* src) {
    if (dest && src) {
        for (size_t i = 0; i < NUM_GPR; i++)
            dest->gpr[i] = src->gpr[i];
@@ -103,7 +103,7 @@ int copy_trapframe(trapframe_t* dest, trapframe_t* src) {
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int copy_float_trapframe(float_trapframe_t* dest, float_trapframe_t* src) {
+DUE_HANDLER_TEXT int copy_float_trapframe(float_trapframe_t* dest, float_trapframe_t* src) {
    if (dest && src) {
        for (size_t i = 0; i < NUM_FPR; i++)
            dest->fpr[i] = src->fpr[i];
@@ -114,7 +114,7 @@ int copy_float_trapframe(float_trapframe_t* dest, float_trapframe_t* src) {
 }
 
 //Originally defined in riscv-pk/pk/handlers.c
-int load_value_from_message(word_t* recovered_message, word_t* load_value, due_cacheline_t* cl, size_t load_size, int offset) {
+DUE_HANDLER_TEXT int load_value_from_message(word_t* recovered_message, word_t* load_value, due_cacheline_t* cl, size_t load_size, int offset) {
     if (!recovered_message || !load_value || !cl)
         return -4;
    
@@ -18,6 +18,9 @@ extern "C" {
 #define MAX_CACHELINE_WORDS 32
 #define MAX_WORD_SIZE 32
 
+//Code on the DUE handling path is grouped in one section so that memory_due_init() can prefault, lock and warm it together
+#define DUE_HANDLER_TEXT __attribute__((section("due_handler_text")))
+
 //Originally defined in riscv-pk/pk/pk.h
 typedef struct {
     long gpr[NUM_GPR];
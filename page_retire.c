@@ -0,0 +1,314 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "page_retire.h"
+#include "golden_copy.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int g_due_retire_enabled = 0;
+due_retire_stats_t g_due_retire_stats;
+
+static due_retire_config_t g_retire_config = { DUE_RETIRE_DEFAULT_THRESHOLD, DUE_RETIRE_DEFAULT_BATCH, DUE_RETIRE_DEFAULT_MIN_TICKS, 1 };
+static due_page_t g_retire_pages[MAX_RETIRE_PAGES];
+static due_migratable_t g_migratable[MAX_MIGRATABLE_VARS];
+static size_t g_num_migratable = 0;
+static void* g_quarantine[MAX_QUARANTINED_ALLOCS];
+static size_t g_num_quarantined = 0;
+static unsigned long g_retire_last_batch = 0;
+static unsigned long g_readonly_start[MAX_READONLY_RANGES]; //Mappings without write permission, taken when retirement is enabled
+static unsigned long g_readonly_end[MAX_READONLY_RANGES];
+static size_t g_num_readonly = 0;
+
+//Snapshot of the process's non-writable mappings, so that the trap path can check permissions without a system call. Mappings
+//created later are not covered, but the golden copy index and the text segment bounds still are.
+static void due_retire_scan_readonly() {
+    g_num_readonly = 0;
+#if defined(__linux__)
+    FILE* fp = fopen("/proc/self/maps", "r");
+    if (!fp)
+        return;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long start = 0;
+        unsigned long end = 0;
+        char perms[5] = "";
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, perms) != 3 || perms[1] == 'w')
+            continue;
+        if (g_num_readonly > 0 && g_readonly_end[g_num_readonly-1] == start) { //Merge adjacent mappings, /proc lists them in order
+            g_readonly_end[g_num_readonly-1] = end;
+            continue;
+        }
+        if (g_num_readonly >= MAX_READONLY_RANGES) {
+            printf("Failed to track every read-only mapping, MAX_READONLY_RANGES has been exceeded.\n");
+            break;
+        }
+        g_readonly_start[g_num_readonly] = start;
+        g_readonly_end[g_num_readonly] = end;
+        g_num_readonly++;
+    }
+    fclose(fp);
+#endif
+}
+
+//Writing a recovered message back to code or read-only data would fault again inside the handler
+static DUE_HANDLER_TEXT int due_retire_writable(dueinfo_t* dueinfo, unsigned long addr, size_t size) {
+    if (dueinfo->error_in_text || golden_copy_contains(addr, size))
+        return 0;
+    for (size_t i = 0; i < g_num_readonly; i++) {
+        if (addr < g_readonly_end[i] && addr + size > g_readonly_start[i])
+            return 0;
+    }
+    return 1;
+}
+
+void due_retire_enable(const due_retire_config_t* config) {
+    if (config)
+        g_retire_config = *config;
+    if (g_retire_config.threshold == 0)
+        g_retire_config.threshold = 1;
+    due_retire_scan_readonly();
+    g_due_retire_enabled = 1;
+}
+
+//Brings the tables that due_retire_note() uses in ahead of the first DUE, see memory_due_init()
+int due_retire_prefault(int flags) {
+    int rc = 0;
+    rc |= memory_due_prefault(g_retire_pages, sizeof(g_retire_pages), 1, flags);
+    rc |= memory_due_prefault(g_migratable, sizeof(g_migratable), 1, flags);
+    rc |= memory_due_prefault(g_readonly_start, sizeof(g_readonly_start), 0, flags);
+    rc |= memory_due_prefault(g_readonly_end, sizeof(g_readonly_end), 0, flags);
+    rc |= memory_due_prefault(&g_retire_config, sizeof(g_retire_config), 0, flags);
+    rc |= memory_due_prefault(&g_due_retire_stats, sizeof(g_due_retire_stats), 1, flags);
+    return rc;
+}
+
+void due_retire_disable() {
+    g_due_retire_enabled = 0;
+}
+
+int due_retire_register(const char* name, void** owner, void** start, void** end) {
+    if (!owner || !start || !end)
+        return -4;
+    for (size_t i = 0; i < g_num_migratable; i++) {
+        if (g_migratable[i].start == start) {
+            g_migratable[i].owner = owner;
+            g_migratable[i].end = end;
+            return 0;
+        }
+    }
+    if (g_num_migratable >= MAX_MIGRATABLE_VARS) {
+        printf("Failed to register migratable variable %s, MAX_MIGRATABLE_VARS has been exceeded.\n", (name ? name : ""));
+        return -4;
+    }
+    due_migratable_t* m = g_migratable + g_num_migratable;
+    memset(m, 0, sizeof(*m));
+    snprintf(m->name, NAME_SIZE, "%s", (name ? name : ""));
+    m->owner = owner;
+    m->start = start;
+    m->end = end;
+    g_num_migratable++;
+    return 0;
+}
+
+//Open addressing on the page number. When the table is full, new pages are simply not tracked.
+static DUE_HANDLER_TEXT due_page_t* due_retire_page(unsigned long page) {
+    size_t h = (size_t)((page / DUE_RETIRE_PAGE_SIZE) * 0x9e3779b97f4a7c15UL >> 32) & (MAX_RETIRE_PAGES-1);
+    for (size_t probe = 0; probe < MAX_RETIRE_PAGES; probe++) {
+        due_page_t* p = g_retire_pages + ((h+probe) & (MAX_RETIRE_PAGES-1));
+        if (p->page == page)
+            return p;
+        if (p->page == 0) {
+            p->page = page;
+            p->faults = 0;
+            p->retired = 0;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+//Called from memory_due_handler_entry() after the user handler, in trap context: no allocation or copying of variables here
+DUE_HANDLER_TEXT void due_retire_note(dueinfo_t* dueinfo) {
+    if (!dueinfo || !dueinfo->valid || dueinfo->mem_type != 0 || dueinfo->recovery_mode != 0)
+        return;
+    word_t* msg = &(dueinfo->recovered_message);
+    unsigned long badvaddr = (unsigned long)(dueinfo->tf.badvaddr);
+    if (g_retire_config.writeback && msg->size > 0 && msg->size <= MAX_WORD_SIZE) {
+        unsigned long msg_addr = badvaddr - badvaddr % msg->size;
+        if (due_retire_writable(dueinfo, msg_addr, msg->size)) {
+            memcpy((void*)msg_addr, msg->bytes, msg->size);
+            g_due_retire_stats.writebacks++;
+        } else
+            g_due_retire_stats.readonly_writebacks++;
+    }
+
+    unsigned long page = badvaddr & ~((unsigned long)DUE_RETIRE_PAGE_SIZE-1);
+    due_page_t* p = due_retire_page(page);
+    if (!p)
+        return;
+    p->faults++;
+    g_due_retire_stats.faults_counted++;
+    if (p->faults < g_retire_config.threshold)
+        return;
+
+    //Flagged again on every later DUE, so that a variable whose migration failed is retried
+    int crossed = (p->faults == g_retire_config.threshold);
+    if (crossed)
+        g_due_retire_stats.pages_over_threshold++;
+    int found = 0;
+    for (size_t i = 0; i < g_num_migratable; i++) {
+        unsigned long start = (unsigned long)*(g_migratable[i].start);
+        unsigned long end = (unsigned long)*(g_migratable[i].end);
+        if (start < page + DUE_RETIRE_PAGE_SIZE && end > page) {
+            g_migratable[i].pending = 1;
+            found = 1;
+        }
+    }
+    if (!found && crossed)
+        g_due_retire_stats.unmovable_pages++;
+}
+
+//1 if the range overlaps any page that has crossed the fault threshold
+static int due_retire_overlaps_weak(unsigned long start, size_t size) {
+    for (size_t i = 0; i < MAX_RETIRE_PAGES; i++) {
+        due_page_t* p = g_retire_pages+i;
+        if (p->page != 0 && p->faults >= g_retire_config.threshold && start < p->page + DUE_RETIRE_PAGE_SIZE && start + size > p->page)
+            return 1;
+    }
+    return 0;
+}
+
+static int due_retire_migrate(due_migratable_t* m) {
+    unsigned char* old_start = (unsigned char*)*(m->start);
+    unsigned char* old_end = (unsigned char*)*(m->end);
+    if (!old_start || old_end <= old_start || *(m->owner) != old_start)
+        return -4;
+    if (g_num_quarantined >= MAX_QUARANTINED_ALLOCS) {
+        printf("Failed to migrate %s, quarantine is full.\n", m->name);
+        return -4;
+    }
+    size_t size = (size_t)(old_end - old_start);
+
+    //The quarantined allocation only keeps its own bytes out of malloc's hands, the rest of a weak page can still be handed out.
+    //Rejected blocks are held until we are done so that each retry gets a different one. The later tries ask for whole pages, which
+    //cannot start on a page that a quarantined allocation still occupies.
+    void* rejected[DUE_RETIRE_ALLOC_TRIES];
+    size_t num_rejected = 0;
+    void* fresh = NULL;
+    for (size_t attempt = 0; attempt < DUE_RETIRE_ALLOC_TRIES; attempt++) {
+        void* p = NULL;
+        if (attempt < DUE_RETIRE_ALLOC_TRIES/2)
+            p = malloc(size);
+        else if (posix_memalign(&p, DUE_RETIRE_PAGE_SIZE, (size + DUE_RETIRE_PAGE_SIZE-1) & ~((size_t)DUE_RETIRE_PAGE_SIZE-1)) != 0)
+            p = NULL;
+        if (!p)
+            break;
+        if (!due_retire_overlaps_weak((unsigned long)p, size)) {
+            fresh = p;
+            break;
+        }
+        rejected[num_rejected++] = p;
+        g_due_retire_stats.weak_allocs++;
+    }
+    for (size_t i = 0; i < num_rejected; i++)
+        free(rejected[i]);
+    if (!fresh) {
+        printf("Failed to migrate %s, could not allocate %lu bytes clear of weak pages\n", m->name, size);
+        return -4;
+    }
+    memcpy(fresh, old_start, size);
+
+    //Publish an empty range first, so a DUE in the middle of the update is never attributed to a half-moved variable. Readers treat
+    //NULL bounds as a disabled variable, and every intermediate state below is empty or complete. The stores are volatile and
+    //separated by compiler barriers so that none of them is merged away or reordered.
+    void* volatile* start = (void* volatile*)(m->start);
+    void* volatile* end = (void* volatile*)(m->end);
+    *end = NULL;
+    asm volatile("" ::: "memory");
+    *start = NULL;
+    asm volatile("" ::: "memory");
+    *start = fresh;
+    asm volatile("" ::: "memory");
+    *end = (unsigned char*)fresh + size;
+    asm volatile("" ::: "memory");
+    *(m->owner) = fresh;
+
+    //Never free the old allocation, or malloc would hand its part of the weak page straight back out
+    g_quarantine[g_num_quarantined++] = old_start;
+    g_due_retire_stats.quarantined_bytes += size;
+    g_due_retire_stats.bytes_migrated += size;
+    m->migrations++;
+    return 0;
+}
+
+//Migrates pending variables at a safe point. Batched and rate-limited, because a fault storm can flag many pages at once.
+size_t due_retire_process() {
+    size_t migrated = 0;
+    int any_pending = 0;
+    for (size_t i = 0; i < g_num_migratable && !any_pending; i++)
+        any_pending = g_migratable[i].pending;
+    if (!any_pending)
+        return 0;
+
+    unsigned long now = get_sim_tick_counter();
+    if (g_retire_last_batch != 0 && now - g_retire_last_batch < g_retire_config.min_ticks_between_batches) {
+        g_due_retire_stats.deferred_batches++;
+        return 0;
+    }
+    g_retire_last_batch = now;
+
+    for (size_t i = 0; i < g_num_migratable && migrated < g_retire_config.max_migrations_per_batch; i++) {
+        due_migratable_t* m = g_migratable+i;
+        if (!m->pending)
+            continue;
+        if (due_retire_migrate(m) == 0) { //A failed migration stays pending and is retried in a later batch
+            m->pending = 0;
+            migrated++;
+            g_due_retire_stats.migrations++;
+        } else
+            g_due_retire_stats.failed_migrations++;
+    }
+
+    //Pages whose variables have all moved away are retired
+    for (size_t i = 0; i < MAX_RETIRE_PAGES; i++) {
+        due_page_t* p = g_retire_pages+i;
+        if (p->page == 0 || p->retired || p->faults < g_retire_config.threshold)
+            continue;
+        int still_used = 0;
+        for (size_t j = 0; j < g_num_migratable && !still_used; j++) {
+            unsigned long start = (unsigned long)*(g_migratable[j].start);
+            unsigned long end = (unsigned long)*(g_migratable[j].end);
+            still_used = (start < p->page + DUE_RETIRE_PAGE_SIZE && end > p->page);
+        }
+        if (!still_used)
+            p->retired = 1;
+    }
+    return migrated;
+}
+
+void dump_due_retire_stats() {
+    printf("Recovered message write-backs: %lu\n", g_due_retire_stats.writebacks);
+    printf("Write-backs skipped for read-only memory: %lu\n", g_due_retire_stats.readonly_writebacks);
+    printf("Page faults counted: %lu\n", g_due_retire_stats.faults_counted);
+    printf("Pages over fault threshold: %lu\n", g_due_retire_stats.pages_over_threshold);
+    printf("Pages over threshold with no migratable data: %lu\n", g_due_retire_stats.unmovable_pages);
+    printf("Migrations: %lu\n", g_due_retire_stats.migrations);
+    printf("Bytes migrated: %lu\n", g_due_retire_stats.bytes_migrated);
+    printf("Failed migrations: %lu\n", g_due_retire_stats.failed_migrations);
+    printf("Allocations rejected for overlapping weak pages: %lu\n", g_due_retire_stats.weak_allocs);
+    printf("Migration batches deferred by rate limit: %lu\n", g_due_retire_stats.deferred_batches);
+    printf("Quarantined bytes: %lu\n", g_due_retire_stats.quarantined_bytes);
+    for (size_t i = 0; i < MAX_RETIRE_PAGES; i++) {
+        due_page_t* p = g_retire_pages+i;
+        if (p->page != 0 && p->faults >= g_retire_config.threshold)
+            printf("Page %p: %lu faults%s\n", (void*)(p->page), p->faults, (p->retired ? ", retired" : ""));
+    }
+    for (size_t i = 0; i < g_num_migratable; i++)
+        printf("Migratable %s [%p, %p): %lu migrations%s\n", g_migratable[i].name, *(g_migratable[i].start), *(g_migratable[i].end), g_migratable[i].migrations, (g_migratable[i].pending ? ", pending" : ""));
+}
@@ -0,0 +1,89 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Post-recovery write-back and faulty-page retirement. After a successful recovery the recovered message is written back to
+ * memory, and DUEs are counted per page. Once a page crosses the fault threshold, registered heap variables on it are
+ * migrated to fresh memory clear of every such page at the next DUE_RETIRE_PROCESS() point, and the old allocation is
+ * quarantined (never freed).
+ */
+
+#ifndef PAGE_RETIRE_H
+#define PAGE_RETIRE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define DUE_RETIRE_PAGE_SIZE 4096
+#define MAX_RETIRE_PAGES 256 //Must be a power of two
+#define MAX_MIGRATABLE_VARS 32
+#define MAX_QUARANTINED_ALLOCS 64
+#define MAX_READONLY_RANGES 128
+#define DUE_RETIRE_ALLOC_TRIES 8 //Allocations tried per migration before giving up on one clear of weak pages
+#define DUE_RETIRE_DEFAULT_THRESHOLD 4
+#define DUE_RETIRE_DEFAULT_BATCH 4
+#define DUE_RETIRE_DEFAULT_MIN_TICKS 100000
+
+typedef struct {
+    unsigned long threshold; //DUEs on a page before its variables are migrated
+    unsigned long max_migrations_per_batch;
+    unsigned long min_ticks_between_batches;
+    int writeback; //Write the recovered message back to memory after user recovery
+} due_retire_config_t;
+
+typedef struct {
+    unsigned long page; //Page address, 0 if unused
+    unsigned long faults;
+    int retired;
+} due_page_t;
+
+typedef struct {
+    char name[NAME_SIZE];
+    void** owner; //The application's pointer to the data
+    void** start; //RECOVERY_ADDR
+    void** end; //RECOVERY_END_ADDR
+    int pending;
+    unsigned long migrations;
+} due_migratable_t;
+
+typedef struct {
+    unsigned long writebacks;
+    unsigned long readonly_writebacks; //Skipped because the recovered address is code or read-only data
+    unsigned long faults_counted;
+    unsigned long pages_over_threshold;
+    unsigned long unmovable_pages; //Over threshold, but nothing registered with EN_MIGRATION lives there
+    unsigned long migrations;
+    unsigned long bytes_migrated;
+    unsigned long failed_migrations;
+    unsigned long weak_allocs; //Fresh allocations rejected because they overlapped a page over the threshold
+    unsigned long deferred_batches; //Batches skipped by the rate limit
+    unsigned long quarantined_bytes;
+} due_retire_stats_t;
+
+extern int g_due_retire_enabled;
+extern due_retire_stats_t g_due_retire_stats;
+
+//Must come after EN_RECOVERY_PTR for the same variable. Only heap data reached through variable can be moved.
+#define EN_MIGRATION(scope, variable) \
+    due_retire_register(STRINGIFY(VARIABLE_SCOPE_ADDR_PASTER(scope, variable)), (void**)&(variable), &RECOVERY_ADDR(scope, variable), &RECOVERY_END_ADDR(scope, variable));
+
+#define DUE_RETIRE_PROCESS() \
+    due_retire_process();
+
+void due_retire_enable(const due_retire_config_t* config);
+void due_retire_disable();
+int due_retire_register(const char* name, void** owner, void** start, void** end);
+int due_retire_prefault(int flags);
+void due_retire_note(dueinfo_t* dueinfo);
+size_t due_retire_process();
+void dump_due_retire_stats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
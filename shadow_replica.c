@@ -0,0 +1,146 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "shadow_replica.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Each 8-byte word of the replica contributes word*(2i+1) to a wrapping sum. Odd weights keep every single-bit flip visible,
+//and a store only needs to subtract the old contributions of the words it touches and add the new ones.
+static unsigned long replica_word(const unsigned char* shadow, size_t size, size_t i) {
+    unsigned long w = 0;
+    size_t off = i*sizeof(unsigned long);
+    memcpy(&w, shadow+off, (size-off < sizeof(unsigned long) ? size-off : sizeof(unsigned long)));
+    return w;
+}
+
+static unsigned long replica_checksum_range(const unsigned char* shadow, size_t size, size_t first, size_t last) {
+    unsigned long sum = 0;
+    for (size_t i = first; i <= last; i++)
+        sum += replica_word(shadow, size, i) * (2*i+1);
+    return sum;
+}
+
+static unsigned long replica_checksum(const unsigned char* shadow, size_t size) {
+    if (size == 0)
+        return 0;
+    return replica_checksum_range(shadow, size, 0, (size-1)/sizeof(unsigned long));
+}
+
+int replica_init(replica_t* rep, void* start, void* end, int batched) {
+    if (!rep || !start || !end || end <= start)
+        return -4;
+    size_t size = (size_t)((unsigned char*)end - (unsigned char*)start);
+    void* alloc = malloc(size + REPLICA_ALIGN);
+    if (!alloc) {
+        printf("Failed to allocate shadow replica of %lu bytes\n", size);
+        return -4;
+    }
+    rep->start = start;
+    rep->size = size;
+    rep->shadow_alloc = alloc;
+    rep->shadow = (unsigned char*)(((unsigned long)alloc + REPLICA_ALIGN-1) & ~((unsigned long)REPLICA_ALIGN-1)); //Own page, never shares a line with the primary
+    rep->batched = batched;
+    rep->writes = 0;
+    rep->bytes_written = 0;
+    rep->write_ticks = 0;
+    rep->syncs = 0;
+    rep->sync_ticks = 0;
+    memcpy(rep->shadow, start, size);
+    rep->checksum = replica_checksum(rep->shadow, size);
+    return 0;
+}
+
+void replica_free(replica_t* rep) {
+    if (rep && rep->shadow_alloc) {
+        free(rep->shadow_alloc);
+        rep->shadow_alloc = NULL;
+        rep->shadow = NULL;
+        rep->size = 0;
+    }
+}
+
+void replica_update(replica_t* rep, void* addr, size_t size) {
+    if (!rep->shadow || (unsigned char*)addr < (unsigned char*)rep->start || (unsigned char*)addr + size > (unsigned char*)rep->start + rep->size || size == 0)
+        return;
+    unsigned long starttick = get_sim_tick_counter();
+    size_t off = (size_t)((unsigned char*)addr - (unsigned char*)rep->start);
+    size_t first = off / sizeof(unsigned long);
+    size_t last = (off+size-1) / sizeof(unsigned long);
+    unsigned long sum = rep->checksum - replica_checksum_range(rep->shadow, rep->size, first, last);
+    memcpy(rep->shadow+off, addr, size);
+    rep->checksum = sum + replica_checksum_range(rep->shadow, rep->size, first, last);
+    rep->writes++;
+    rep->bytes_written += size;
+    rep->write_ticks += get_sim_tick_counter() - starttick;
+}
+
+void replica_sync(replica_t* rep) {
+    if (!rep->shadow)
+        return;
+    unsigned long starttick = get_sim_tick_counter();
+    memcpy(rep->shadow, rep->start, rep->size);
+    rep->checksum = replica_checksum(rep->shadow, rep->size);
+    rep->syncs++;
+    rep->sync_ticks += get_sim_tick_counter() - starttick;
+}
+
+int replica_verify(replica_t* rep) {
+    if (!rep || !rep->shadow)
+        return -4;
+    return (replica_checksum(rep->shadow, rep->size) == rep->checksum ? 0 : -1);
+}
+
+int replica_recover(replica_t* rep, dueinfo_t* dueinfo) {
+    if (!rep || !rep->shadow || !dueinfo || !dueinfo->valid)
+        return -4;
+    size_t msg_size = dueinfo->recovered_message.size;
+    if (msg_size == 0 || msg_size > MAX_WORD_SIZE)
+        return -4;
+
+    //Portion of the victim message that belongs to the replicated variable
+    unsigned long msg_addr = (unsigned long)(dueinfo->tf.badvaddr) - (unsigned long)(dueinfo->tf.badvaddr) % msg_size;
+    unsigned long var_start = (unsigned long)rep->start;
+    unsigned long var_end = var_start + rep->size;
+    unsigned long lo = (msg_addr > var_start ? msg_addr : var_start);
+    unsigned long hi = (msg_addr + msg_size < var_end ? msg_addr + msg_size : var_end);
+    if (lo >= hi)
+        return -4;
+    if (replica_verify(rep) != 0) { //Replica itself is corrupted, nothing to trust
+        printf("Shadow replica checksum mismatch, cannot recover from it.\n");
+        return -4;
+    }
+    const unsigned char* golden = rep->shadow + (lo - var_start);
+    size_t msg_off = lo - msg_addr;
+    size_t len = hi - lo;
+
+    //Prefer a candidate that agrees with the replica: the replica confirms the candidate, and the candidate supplies bytes outside the variable
+    for (size_t i = 0; i < dueinfo->candidates.size; i++) {
+        word_t* cand = dueinfo->candidates.candidate_messages+i;
+        if (cand->size == msg_size && memcmp(cand->bytes + msg_off, golden, len) == 0) {
+            copy_word(&(dueinfo->recovered_message), cand);
+            return 0;
+        }
+    }
+
+    //No candidate agrees. A batched replica may simply be stale since the last sync, so only a write-barrier replica is trusted outright.
+    if (rep->batched)
+        return -1;
+    memcpy(dueinfo->recovered_message.bytes + msg_off, golden, len);
+    return 0;
+}
+
+void dump_replica(replica_t* rep) {
+    if (rep && rep->shadow) {
+        printf("Replica of [%p, %p), shadow at %p, %s\n", rep->start, (void*)((unsigned char*)rep->start + rep->size), (void*)rep->shadow, (rep->batched ? "batched" : "write-barrier"));
+        printf("Replica checksum: 0x%016lx (%s)\n", rep->checksum, (replica_verify(rep) == 0 ? "OK" : "MISMATCH"));
+        printf("Replica barrier writes: %lu (%lu bytes), average ticks per write: %f\n", rep->writes, rep->bytes_written, (rep->writes > 0 ? (double)(rep->write_ticks) / (double)(rep->writes) : 0));
+        printf("Replica syncs: %lu, average ticks per sync: %f\n", rep->syncs, (rep->syncs > 0 ? (double)(rep->sync_ticks) / (double)(rep->syncs) : 0));
+    } else
+        printf("No replica enabled.\n");
+}
@@ -0,0 +1,76 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Opt-in software shadow replicas for correctness-critical variables.
+ * The replica lives in its own page-aligned allocation and is kept checksummed, either through a write barrier
+ * (REPLICA_WRITE) on every store or through batched sync points (REPLICA_SYNC).
+ */
+
+#ifndef SHADOW_REPLICA_H
+#define SHADOW_REPLICA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+
+#define REPLICA_ALIGN 4096
+
+typedef struct {
+    void* start;
+    size_t size;
+    unsigned char* shadow;
+    void* shadow_alloc; //What malloc() actually returned
+    unsigned long checksum;
+    int batched; //1 if the replica is only refreshed at sync points and may be stale in between
+    unsigned long writes;
+    unsigned long bytes_written;
+    unsigned long write_ticks; //Time spent in the write barrier
+    unsigned long syncs;
+    unsigned long sync_ticks;
+} replica_t;
+
+#define VARIABLE_SCOPE_REPLICA_PASTER(x,y) x ## _ ## y ## _replica
+
+#define DECL_REPLICA(scope, variable) \
+    replica_t VARIABLE_SCOPE_REPLICA_PASTER(scope, variable) = { NULL, 0, NULL, NULL, 0, 0, 0, 0, 0, 0, 0 };
+
+#define DECL_REPLICA_EXTERN(scope, variable) \
+    extern replica_t VARIABLE_SCOPE_REPLICA_PASTER(scope, variable);
+
+#define REPLICA(scope, variable) \
+    VARIABLE_SCOPE_REPLICA_PASTER(scope, variable)
+
+//Must come after EN_RECOVERY/EN_RECOVERY_PTR for the same variable
+#define EN_REPLICA(scope, variable, batched) \
+    replica_init(&REPLICA(scope, variable), RECOVERY_ADDR(scope, variable), RECOVERY_END_ADDR(scope, variable), batched);
+
+//A single statement, so it is safe in an unbraced if/else. Unlike the other macros it takes the caller's semicolon.
+#define REPLICA_WRITE(scope, variable, lvalue, value) \
+    do { \
+        (lvalue) = (value); \
+        replica_update(&REPLICA(scope, variable), &(lvalue), sizeof(lvalue)); \
+    } while (0)
+
+#define REPLICA_SYNC(scope, variable) \
+    replica_sync(&REPLICA(scope, variable));
+
+#define REPLICA_RECOVER(fname, variable, dueinfo) \
+    replica_recover(&REPLICA(fname, variable), dueinfo)
+
+int replica_init(replica_t* rep, void* start, void* end, int batched);
+void replica_free(replica_t* rep);
+void replica_update(replica_t* rep, void* addr, size_t size);
+void replica_sync(replica_t* rep);
+int replica_verify(replica_t* rep);
+int replica_recover(replica_t* rep, dueinfo_t* dueinfo);
+void dump_replica(replica_t* rep);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
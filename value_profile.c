@@ -0,0 +1,312 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ */
+
+#include "value_profile.h"
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+#include "ecc_candidates.h"
+#include <stdio.h>
+#include <string.h>
+
+#define VPROF_MAG_CLASSES (VPROF_HIST_BINS/2)
+
+//Static because we don't want these allocated on the stack in trap context
+static unsigned char line_bytes[APPROX_MAX_LINE_BYTES];
+
+//Sign and power-of-two magnitude class, straight from the IEEE exponent so that no libm is needed
+static size_t vprof_bin(double v) {
+    double a = (v < 0 ? -v : v);
+    unsigned long bits;
+    memcpy(&bits, &a, sizeof(bits));
+    long e = (long)((bits >> 52) & 0x7ff) - 1023;
+    size_t mag = 0;
+    if (a >= 1.0/65536)
+        mag = (e > VPROF_MAG_CLASSES-18 ? VPROF_MAG_CLASSES-1 : (size_t)(e+17));
+    return (v < 0 ? VPROF_MAG_CLASSES : 0) + mag;
+}
+
+void value_profile_configure(value_profile_t* prof, unsigned long period_ticks, size_t elems_per_sample) {
+    if (!prof)
+        return;
+    prof->period_ticks = period_ticks;
+    prof->elems_per_sample = (elems_per_sample > 0 ? elems_per_sample : 1);
+}
+
+void value_profile_reset(value_profile_t* prof) {
+    if (!prof)
+        return;
+    approx_elem_type_t type = prof->type;
+    size_t stride = prof->stride;
+    size_t offset = prof->offset;
+    unsigned long period_ticks = prof->period_ticks;
+    size_t elems_per_sample = prof->elems_per_sample;
+    memset(prof, 0, sizeof(*prof));
+    prof->type = type;
+    prof->stride = stride;
+    prof->offset = offset;
+    prof->period_ticks = period_ticks;
+    prof->elems_per_sample = elems_per_sample;
+}
+
+void value_profile_sample(value_profile_t* prof, void* var_start, void* var_end) {
+    unsigned long now = get_sim_tick_counter();
+    if (prof->samples > 0 && now - prof->last_tick < prof->period_ticks) {
+        prof->skipped++;
+        return;
+    }
+    size_t esize = approx_elem_size(prof->type);
+    size_t stride = (prof->stride == 0 ? esize : prof->stride);
+    unsigned char* base = (unsigned char*)var_start + prof->offset;
+    if (esize == 0 || stride < esize || !var_start || (unsigned char*)var_end < base + esize)
+        return;
+    size_t n = (size_t)((unsigned char*)var_end - base - esize) / stride + 1;
+
+    for (size_t i = 0; i < prof->elems_per_sample; i++) {
+        if (prof->cursor >= n) {
+            prof->cursor = 0;
+            prof->passes++;
+        }
+        size_t k = prof->cursor++;
+        double v = approx_decode_element(base + k*stride, prof->type);
+        prof->elems++;
+        if (!approx_is_finite(v)) {
+            prof->nonfinite++;
+            continue;
+        }
+        if (prof->elems == prof->nonfinite+1) {
+            prof->min = v;
+            prof->max = v;
+        } else {
+            prof->min = (v < prof->min ? v : prof->min);
+            prof->max = (v > prof->max ? v : prof->max);
+        }
+        prof->hist[vprof_bin(v)]++;
+        if (k > 0) {
+            double prev = approx_decode_element(base + (k-1)*stride, prof->type);
+            if (approx_is_finite(prev)) {
+                double d = v - prev;
+                if (d == 0)
+                    prof->zero_deltas++;
+                if (prof->deltas > 0 && d == prof->last_delta)
+                    prof->repeated_deltas++;
+                prof->last_delta = d;
+                prof->delta_sum += d;
+                prof->abs_delta_sum += (d < 0 ? -d : d);
+                prof->delta_hist[vprof_bin(d)]++;
+                prof->deltas++;
+            }
+        }
+    }
+    prof->samples++;
+    prof->last_tick = get_sim_tick_counter();
+    prof->sample_ticks += prof->last_tick - now;
+}
+
+//Laplace-smoothed likelihood of the delta between two consecutive elements. The delta histogram is coarse, so the distance from the
+//mean delta is also weighed with a heavy-tailed kernel. This separates candidates that only differ in low-order bits.
+static double vprof_delta_likelihood(const value_profile_t* prof, double d) {
+    if (!approx_is_finite(d) || prof->deltas == 0)
+        return 1;
+    double dist = d - prof->delta_sum / (double)(prof->deltas);
+    double scale = prof->abs_delta_sum / (double)(prof->deltas);
+    double p = (double)(prof->delta_hist[vprof_bin(d)]+1) / (double)(prof->deltas+VPROF_HIST_BINS);
+    return p / (1 + (dist < 0 ? -dist : dist) / (scale > 0 ? scale : 1));
+}
+
+//Laplace-smoothed likelihood of one element value
+static double vprof_likelihood(const value_profile_t* prof, double v) {
+    unsigned long finite = prof->elems - prof->nonfinite;
+    if (!approx_is_finite(v))
+        return (double)(prof->nonfinite+1) / (double)(prof->elems+VPROF_HIST_BINS);
+    double p = (double)(prof->hist[vprof_bin(v)]+1) / (double)(prof->elems+VPROF_HIST_BINS);
+    if (finite > 0) {
+        double slack = (prof->max - prof->min) / 4;
+        if (v < prof->min - slack || v > prof->max + slack)
+            p *= VPROF_OUT_OF_RANGE_PENALTY;
+    }
+    return p;
+}
+
+//Scores every candidate by the likelihood of the variable's elements that it would overwrite, with the rest of the
+//cacheline as context. Returns the index of the most likely candidate, or -1 if the profile cannot tell them apart.
+long value_profile_rank(const value_profile_t* prof, dueinfo_t* dueinfo, void* var_start, void* var_end, double* scores) {
+    if (!prof || !dueinfo || !dueinfo->valid || !var_start || !var_end || prof->elems == 0)
+        return -1;
+    size_t esize = approx_elem_size(prof->type);
+    size_t stride = (prof->stride == 0 ? esize : prof->stride);
+    size_t msg_size = dueinfo->recovered_message.size;
+    due_cacheline_t* cl = &(dueinfo->cacheline);
+    if (esize == 0 || stride < esize)
+        return -1;
+    unsigned long msg_addr = 0;
+    unsigned long line_base = approx_assemble_line(dueinfo, line_bytes, &msg_addr); //The victim is overwritten with each candidate below
+    if (line_base == 0)
+        return -1;
+    unsigned long line_end = line_base + cl->size * msg_size;
+
+    //Elements of the variable that overlap the victim message
+    unsigned long base = (unsigned long)var_start + prof->offset;
+    unsigned long end = ((unsigned long)var_end < line_end ? (unsigned long)var_end : line_end);
+    unsigned long first = (msg_addr + 1 > base + esize ? msg_addr + 1 - esize : base);
+    long k0 = (long)((first - base + stride - 1) / stride);
+    unsigned char* victim = line_bytes + cl->blockpos * msg_size;
+
+    long best = -1;
+    double best_score = 0;
+    int tie = 0;
+    for (size_t c = 0; c < dueinfo->candidates.size; c++) {
+        double score = 0;
+        if (dueinfo->candidates.candidate_messages[c].size == msg_size) {
+            memcpy(victim, dueinfo->candidates.candidate_messages[c].bytes, msg_size);
+            score = 1;
+            int any = 0;
+            for (unsigned long a = base + k0*stride; a < msg_addr + msg_size && a + esize <= end; a += stride) {
+                if (a < line_base)
+                    continue;
+                double v = approx_decode_element(line_bytes + (a - line_base), prof->type);
+                score *= vprof_likelihood(prof, v);
+                if (a >= base + stride && a - stride >= line_base) //Delta from the previous element
+                    score *= vprof_delta_likelihood(prof, v - approx_decode_element(line_bytes + (a - stride - line_base), prof->type));
+                if (a + stride + esize <= end && a + stride >= msg_addr + msg_size) //Delta to the next element, unless the next loop iteration counts it
+                    score *= vprof_delta_likelihood(prof, approx_decode_element(line_bytes + (a + stride - line_base), prof->type) - v);
+                any = 1;
+            }
+            if (!any)
+                score = 0;
+        }
+        if (scores)
+            scores[c] = score;
+        if (score > 0 && (best < 0 || score > best_score)) {
+            best = (long)c;
+            best_score = score;
+            tie = 0;
+        } else if (score > 0 && score == best_score)
+            tie = 1;
+    }
+    return (tie ? -1 : best);
+}
+
+int value_profile_recover(const value_profile_t* prof, dueinfo_t* dueinfo, void* var_start, void* var_end) {
+    long best = value_profile_rank(prof, dueinfo, var_start, var_end, NULL);
+    if (best < 0)
+        return -4;
+    copy_word(&(dueinfo->recovered_message), dueinfo->candidates.candidate_messages+best);
+    return 0;
+}
+
+static unsigned long vprof_rand(unsigned long* state) {
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+//Measures ranking accuracy on synthetic DUEs: random messages of the variable are encoded, hit with as many symbol errors as the code
+//enumerates, and the profile's pick among the resulting candidates is compared to the original. The variable itself is not modified.
+int value_profile_benchmark(const value_profile_t* prof, void* var_start, void* var_end, const ecc_code_t* code, size_t trials, unsigned long seed, value_profile_benchmark_t* result) {
+    if (!prof || !var_start || !var_end || !code || !result || code->k % 8 != 0 || code->k/8 > MAX_WORD_SIZE)
+        return -4;
+    size_t msg_size = code->k/8;
+    size_t line_words = DUE_CACHELINE_SIZE / msg_size;
+    unsigned long first_msg = ((unsigned long)var_start + msg_size-1) / msg_size * msg_size;
+    unsigned long last_msg = (unsigned long)var_end / msg_size * msg_size;
+    if (last_msg <= first_msg || line_words == 0 || line_words > MAX_CACHELINE_WORDS || msg_size*line_words != DUE_CACHELINE_SIZE)
+        return -4;
+    size_t num_msgs = (size_t)(last_msg - first_msg) / msg_size;
+
+    static dueinfo_t info; //Static because it is a large data structure
+    static word_t original;
+    static unsigned char codeword[(ECC_MAX_CODEWORD_BITS+7)/8];
+    unsigned long state = (seed ? seed : 0x9e3779b97f4a7c15UL);
+    memset(result, 0, sizeof(*result));
+
+    for (size_t t = 0; t < trials; t++) {
+        unsigned long msg_addr = first_msg + (vprof_rand(&state) % num_msgs) * msg_size;
+        original.size = msg_size;
+        memcpy(original.bytes, (void*)msg_addr, msg_size);
+        ecc_encode(code, &original, codeword);
+
+        //Distinct random symbols, each with a random nonzero error pattern
+        size_t num_symbols = code->n / code->symbol_bits;
+        size_t hit[ECC_MAX_WEIGHT];
+        for (size_t e = 0; e < code->max_weight && e < ECC_MAX_WEIGHT; e++) {
+            size_t s;
+            int dup;
+            do {
+                s = vprof_rand(&state) % num_symbols;
+                dup = 0;
+                for (size_t j = 0; j < e; j++)
+                    dup |= (hit[j] == s);
+            } while (dup);
+            hit[e] = s;
+            unsigned long pattern = 1 + vprof_rand(&state) % ((1UL << code->symbol_bits) - 1);
+            for (size_t b = 0; b < code->symbol_bits; b++) {
+                if (pattern & (1UL << b)) {
+                    size_t bit = s*code->symbol_bits + b;
+                    codeword[bit/8] ^= (unsigned char)(1 << (bit%8));
+                }
+            }
+        }
+
+        memset(&info, 0, sizeof(info));
+        if (ecc_enumerate_candidates(code, codeword, &(info.candidates), NULL) != 0 || info.candidates.size == 0) {
+            result->unranked++;
+            continue;
+        }
+        info.valid = 1;
+        info.tf.badvaddr = (long)msg_addr;
+        info.recovered_message.size = msg_size;
+        memcpy(info.recovered_message.bytes, codeword, msg_size);
+        unsigned long line_base = msg_addr & ~((unsigned long)DUE_CACHELINE_SIZE-1);
+        info.cacheline.size = line_words;
+        info.cacheline.blockpos = (msg_addr - line_base) / msg_size;
+        for (size_t i = 0; i < line_words; i++) {
+            info.cacheline.words[i].size = msg_size;
+            memcpy(info.cacheline.words[i].bytes, (i == info.cacheline.blockpos ? codeword : (unsigned char*)(line_base + i*msg_size)), msg_size);
+        }
+
+        result->trials++;
+        result->candidates += info.candidates.size;
+        for (size_t c = 0; c < info.candidates.size; c++) {
+            if (memcmp(info.candidates.candidate_messages[c].bytes, original.bytes, msg_size) == 0) {
+                result->expected_random_correct += 1.0 / (double)(info.candidates.size);
+                if (c == 0)
+                    result->first_correct++;
+                break;
+            }
+        }
+        long best = value_profile_rank(prof, &info, var_start, var_end, NULL);
+        if (best < 0)
+            result->unranked++;
+        else if (memcmp(info.candidates.candidate_messages[best].bytes, original.bytes, msg_size) == 0)
+            result->profile_correct++;
+    }
+    return 0;
+}
+
+void dump_value_profile(const value_profile_t* prof) {
+    printf("Value profile: %lu samples, %lu elements, %lu non-finite, %lu passes, %lu skipped calls\n", prof->samples, prof->elems, prof->nonfinite, prof->passes, prof->skipped);
+    printf("Range: [%f, %f]\n", prof->min, prof->max);
+    printf("Deltas: %lu, %lu zero, %lu repeated, mean %f, mean magnitude %f\n", prof->deltas, prof->zero_deltas, prof->repeated_deltas, (prof->deltas > 0 ? prof->delta_sum / (double)(prof->deltas) : 0.0), (prof->deltas > 0 ? prof->abs_delta_sum / (double)(prof->deltas) : 0.0));
+    if (prof->samples > 0)
+        printf("Sampling overhead: %lu ticks, %f ticks per sample\n", prof->sample_ticks, (double)(prof->sample_ticks) / (double)(prof->samples));
+    for (size_t b = 0; b < VPROF_HIST_BINS; b++) {
+        if (prof->hist[b] > 0 || prof->delta_hist[b] > 0)
+            printf("Bin %lu (%c, magnitude class %lu): %lu values, %lu deltas\n", b, (b >= VPROF_MAG_CLASSES ? '-' : '+'), b % VPROF_MAG_CLASSES, prof->hist[b], prof->delta_hist[b]);
+    }
+}
+
+void dump_value_profile_benchmark(const value_profile_benchmark_t* result) {
+    printf("Value profile benchmark: %lu trials, %f candidates per DUE\n", result->trials, (result->trials > 0 ? (double)(result->candidates) / (double)(result->trials) : 0.0));
+    if (result->trials > 0) {
+        printf("Profile-ranked accuracy: %f%%\n", (double)(result->profile_correct) * 100 / (double)(result->trials));
+        printf("First-legal-wins accuracy: %f%%\n", (double)(result->first_correct) * 100 / (double)(result->trials));
+        printf("Expected random-choice accuracy: %f%%\n", result->expected_random_correct * 100 / (double)(result->trials));
+    }
+    printf("Unranked DUEs: %lu\n", result->unranked);
+}
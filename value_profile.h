@@ -0,0 +1,102 @@
+/**
+ * Author: Mark Gottscho
+ * Email: mgottscho@ucla.edu
+ *
+ * Sampled value profiles of registered variables, used as priors for ranking candidate messages.
+ * During normal execution PROFILE_SAMPLE() folds a bounded number of elements into a fixed-size summary (range, a histogram of
+ * sign and magnitude, and a histogram of deltas between consecutive elements). At DUE time each candidate is scored by the
+ * likelihood of the elements it would produce under that summary.
+ */
+
+#ifndef VALUE_PROFILE_H
+#define VALUE_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "memory_due.h"
+#include "minipk.h"
+#include "approx_recovery.h"
+#include "ecc_candidates.h"
+
+#define VPROF_HIST_BINS 64 //Sign times 32 magnitude classes: below 2^-16, then one per power of two up to 2^15 and above
+#define VPROF_DEFAULT_PERIOD_TICKS 10000
+#define VPROF_DEFAULT_ELEMS_PER_SAMPLE 16
+#define VPROF_OUT_OF_RANGE_PENALTY 0.001 //Likelihood factor for a value well outside the sampled range
+
+typedef struct {
+    //Configuration
+    approx_elem_type_t type;
+    size_t stride; //Bytes between consecutive elements, 0 means tightly packed
+    size_t offset; //Byte offset of the first element from the start of the variable
+    unsigned long period_ticks; //Minimum ticks between samples
+    size_t elems_per_sample; //Elements read per sample
+
+    //Summary
+    unsigned long samples;
+    unsigned long elems;
+    unsigned long nonfinite;
+    double min;
+    double max;
+    unsigned long hist[VPROF_HIST_BINS];
+    unsigned long deltas;
+    unsigned long zero_deltas;
+    unsigned long repeated_deltas; //Same delta as the previous pair, i.e., arithmetic runs
+    double last_delta;
+    double delta_sum;
+    double abs_delta_sum;
+    unsigned long delta_hist[VPROF_HIST_BINS];
+
+    //Sampling state and overhead
+    size_t cursor; //Next element index, sampling sweeps the variable round-robin
+    unsigned long passes;
+    unsigned long last_tick;
+    unsigned long sample_ticks;
+    unsigned long skipped; //Calls that fell inside the sampling period
+} value_profile_t;
+
+typedef struct {
+    unsigned long trials;
+    unsigned long profile_correct;
+    unsigned long first_correct; //First-legal-wins baseline
+    unsigned long unranked; //Profile could not score any candidate
+    double expected_random_correct;
+    unsigned long candidates;
+} value_profile_benchmark_t;
+
+#define VARIABLE_SCOPE_PROFILE_PASTER(x,y) x ## _ ## y ## _value_profile
+
+#define DECL_VALUE_PROFILE(scope, variable, elem_type) \
+    value_profile_t VARIABLE_SCOPE_PROFILE_PASTER(scope, variable) = { elem_type, 0, 0, VPROF_DEFAULT_PERIOD_TICKS, VPROF_DEFAULT_ELEMS_PER_SAMPLE };
+
+#define DECL_VALUE_PROFILE_EXTERN(scope, variable) \
+    extern value_profile_t VARIABLE_SCOPE_PROFILE_PASTER(scope, variable);
+
+#define VALUE_PROFILE(scope, variable) \
+    VARIABLE_SCOPE_PROFILE_PASTER(scope, variable)
+
+//Cheap enough for inner loops: returns right away unless the sampling period has elapsed
+#define PROFILE_SAMPLE(scope, variable) \
+    value_profile_sample(&VALUE_PROFILE(scope, variable), RECOVERY_ADDR(scope, variable), RECOVERY_END_ADDR(scope, variable));
+
+#define PROFILE_RANK(fname, variable, dueinfo, scores) \
+    value_profile_rank(&VALUE_PROFILE(fname, variable), dueinfo, RECOVERY_ADDR(fname, variable), RECOVERY_END_ADDR(fname, variable), scores)
+
+#define PROFILE_RECOVER(fname, variable, dueinfo) \
+    value_profile_recover(&VALUE_PROFILE(fname, variable), dueinfo, RECOVERY_ADDR(fname, variable), RECOVERY_END_ADDR(fname, variable))
+
+void value_profile_configure(value_profile_t* prof, unsigned long period_ticks, size_t elems_per_sample);
+void value_profile_reset(value_profile_t* prof);
+void value_profile_sample(value_profile_t* prof, void* var_start, void* var_end);
+long value_profile_rank(const value_profile_t* prof, dueinfo_t* dueinfo, void* var_start, void* var_end, double* scores);
+int value_profile_recover(const value_profile_t* prof, dueinfo_t* dueinfo, void* var_start, void* var_end);
+int value_profile_benchmark(const value_profile_t* prof, void* var_start, void* var_end, const ecc_code_t* code, size_t trials, unsigned long seed, value_profile_benchmark_t* result);
+void dump_value_profile(const value_profile_t* prof);
+void dump_value_profile_benchmark(const value_profile_benchmark_t* result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif